@@ -0,0 +1,195 @@
+#include "inventory.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <random>
+
+// Microbenchmarks for the core ItemManager operations.
+//
+// Usage: midterm_project_oop_bench [--max-size N] [--json FILE]
+//
+// Every operation is measured on inventories of 1e3, 1e4, ... items up to
+// --max-size (default 1e6, the full range goes to 1e7 but needs several GB of
+// RAM). Results are printed as a table and, with --json, written as JSON that
+// can be diffed across releases.
+
+// Counts heap allocations so each benchmark can report allocations per op
+static atomic<uint64_t> allocations(0);
+
+void *operator new(size_t size) {
+    allocations.fetch_add(1, memory_order_relaxed);
+    if (void *memory = malloc(size ? size : 1))
+        return memory;
+    throw bad_alloc();
+}
+
+// Over-aligned types (the reservation counters) take this path
+void *operator new(size_t size, align_val_t alignment) {
+    allocations.fetch_add(1, memory_order_relaxed);
+    size_t align = static_cast<size_t>(alignment);
+    if (void *memory = aligned_alloc(align, (size + align - 1) / align * align))
+        return memory;
+    throw bad_alloc();
+}
+
+// GCC flags free() in a replaced operator delete once it is inlined into new-expressions
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void *memory) noexcept { free(memory); }
+void operator delete(void *memory, size_t) noexcept { free(memory); }
+void operator delete(void *memory, align_val_t) noexcept { free(memory); }
+void operator delete(void *memory, size_t, align_val_t) noexcept { free(memory); }
+#pragma GCC diagnostic pop
+
+struct BenchmarkResult {
+    string name;
+    int size;
+    uint64_t iterations;
+    double nsPerOp;
+    double opsPerSecond;
+    double allocationsPerOp;
+};
+
+// Repeats op until it has run for at least MIN_TIME (or MAX_ITERATIONS times)
+template <typename Operation>
+BenchmarkResult measure(const string &name, int size, Operation op) {
+    const double MIN_TIME = 0.2;
+    const uint64_t MAX_ITERATIONS = 10000000;
+
+    op(0);  // Warm up caches and lazily built state
+    uint64_t iterations = 0, batch = 1;
+    uint64_t allocationsBefore = allocations.load();
+    auto start = chrono::steady_clock::now();
+    double elapsed = 0;
+    while (elapsed < MIN_TIME && iterations < MAX_ITERATIONS) {
+        for (uint64_t i = 0; i < batch; ++i)
+            op(iterations + i);
+        iterations += batch;
+        batch *= 2;
+        elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+    uint64_t allocated = allocations.load() - allocationsBefore;
+    return {name, size, iterations, elapsed * 1e9 / iterations, iterations / elapsed,
+            static_cast<double>(allocated) / iterations};
+}
+
+static const char *CATEGORIES[] = {"Clothing", "Electronics", "Entertainment"};
+
+string itemId(int index) {
+    return "SKU" + to_string(index);
+}
+
+string itemName(int index) {
+    return "Item " + to_string(index * 7919 % 1000003);
+}
+
+void populate(ItemManager &manager, int size) {
+    mt19937 random(size);
+    for (int i = 0; i < size; ++i) {
+        manager.add(itemId(i), itemName(i), static_cast<int>(random() % 50), 1 + random() % 10000 / 100.0,
+                    CATEGORIES[i % 3]);
+    }
+}
+
+vector<BenchmarkResult> runBenchmarks(int size) {
+    vector<BenchmarkResult> results;
+    ItemManager manager;
+    populate(manager, size);
+
+    // Precomputed keys keep string building out of the timed loops
+    const int KEYS = 1024;
+    mt19937 random(42);
+    vector<string> ids(KEYS), names(KEYS);
+    for (int i = 0; i < KEYS; ++i) {
+        int index = static_cast<int>(random() % size);
+        ids[i] = itemId(index);
+        names[i] = toUpperCase(itemName(index));
+    }
+
+    results.push_back(measure("findItemById", size, [&](uint64_t i) {
+        ItemView view;
+        if (manager.find(ids[i % KEYS], view) != STATUS_OK)
+            abort();
+    }));
+    results.push_back(measure("findItemByName", size, [&](uint64_t i) {
+        ItemView view;
+        if (manager.findByName(names[i % KEYS], view) != STATUS_OK)
+            abort();
+    }));
+    results.push_back(measure("addItem_duplicate", size, [&](uint64_t i) {
+        if (manager.add(ids[i % KEYS], "Duplicate", 1, 1, "Clothing") != STATUS_DUPLICATE_ID)
+            abort();
+    }));
+    results.push_back(measure("listItems_category", size, [&](uint64_t i) {
+        vector<ItemView> page;
+        manager.listItems({LIST_CATEGORY, CATEGORIES[i % 3]}, 0, size, page);
+    }));
+    results.push_back(measure("listItems_lowStock", size, [&](uint64_t) {
+        vector<ItemView> page;
+        manager.listItems({LIST_LOW_STOCK, ""}, 0, size, page);
+    }));
+    // A quantity change before every listing defeats the result cache
+    results.push_back(measure("listItems_lowStock_uncached", size, [&](uint64_t i) {
+        manager.update(ids[i % KEYS], UPDATE_QUANTITY, static_cast<double>(i % 50));
+        vector<ItemView> page;
+        manager.listItems({LIST_LOW_STOCK, ""}, 0, size, page);
+    }));
+    // Alternating key sets so the sort never short-circuits on an unchanged order
+    results.push_back(measure("sortItems", size, [&](uint64_t i) {
+        if (i % 2)
+            manager.sortBy({{SORT_CATEGORY, true}, {SORT_PRICE, false}, {SORT_NAME, true}});
+        else
+            manager.sortBy({{SORT_ID, true}});
+    }));
+    // Removes an item and adds it back at the end, so the size stays put
+    results.push_back(measure("removeItems", size, [&](uint64_t i) {
+        string id = itemId(static_cast<int>(i * 2654435761u % size));
+        ItemView item;
+        manager.remove(id, &item);
+        manager.add(id, item->getName(), item->getQuantity(), item->getPrice(), item->getCategory());
+    }));
+    return results;
+}
+
+void writeJson(ostream &out, const vector<BenchmarkResult> &results) {
+    out << "{\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchmarkResult &result = results[i];
+        out << "    {\"name\": \"" << result.name << "\", \"size\": " << result.size
+            << ", \"iterations\": " << result.iterations << ", \"ns_per_op\": " << result.nsPerOp
+            << ", \"ops_per_sec\": " << result.opsPerSecond << ", \"allocs_per_op\": " << result.allocationsPerOp
+            << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+int main(int argc, char *argv[]) {
+    int maxSize = 1000000;
+    string jsonPath;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (string(argv[i]) == "--max-size")
+            maxSize = atoi(argv[i + 1]);
+        else if (string(argv[i]) == "--json")
+            jsonPath = argv[i + 1];
+    }
+
+    cout << left << setw(30) << "Benchmark" << setw(10) << "Size" << setw(14) << "ns/op" << setw(14)
+         << "ops/s" << setw(12) << "allocs/op" << endl;
+    vector<BenchmarkResult> all;
+    for (int size = 1000; size <= maxSize; size *= 10) {
+        for (const BenchmarkResult &result : runBenchmarks(size)) {
+            cout << left << setw(30) << result.name << setw(10) << result.size << setw(14) << fixed
+                 << setprecision(1) << result.nsPerOp << setw(14) << setprecision(0) << result.opsPerSecond
+                 << setw(12) << setprecision(2) << result.allocationsPerOp << endl;
+            all.push_back(result);
+        }
+    }
+
+    if (!jsonPath.empty()) {
+        ofstream json(jsonPath);
+        writeJson(json, all);
+        cout << "Results written to " << jsonPath << endl;
+    }
+    return 0;
+}
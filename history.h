@@ -0,0 +1,191 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "memory_tracker.h"
+
+using namespace std;
+
+// One point in an item's quantity history
+struct QuantityChange {
+    uint32_t time;  // Seconds since the Unix epoch
+    int quantity;   // Quantity from then on
+};
+
+// Recent quantity changes of every item, kept in one shared arena of fixed-size
+// ring buffers, one ring per item. Each change is stored as two varints, the
+// seconds since the previous change and the zigzag-encoded quantity delta, so
+// a typical change takes 2-4 bytes. When a ring fills, its oldest changes are
+// folded into the ring's base point to make room.
+//
+// Alongside the ring each item keeps an exponentially decayed count of units
+// sold (quantity decreases), updated as sales are recorded, so ranking items
+// by sales rate needs no decoding.
+//
+// Not synchronized: ItemManager records under its exclusive lock and reads
+// under its shared lock.
+class QuantityHistory {
+public:
+    static const size_t RING_BYTES = 48;
+    static constexpr double RATE_TIME_CONSTANT = 7 * 86400.0;  // Seconds; recent sales weigh most
+
+    // Starts a history at the given quantity and returns its slot
+    uint32_t allocate(uint32_t now, int quantity) {
+        uint32_t slot;
+        if (!freeSlots.empty()) {
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+        } else {
+            slot = static_cast<uint32_t>(headers.size());
+            headers.emplace_back();
+            ring.resize(ring.size() + RING_BYTES);
+        }
+        headers[slot] = {now, quantity, now, quantity, 0, now, 0, 0};
+        return slot;
+    }
+
+    void release(uint32_t slot) {
+        freeSlots.push_back(slot);
+    }
+
+    void record(uint32_t slot, uint32_t now, int quantity) {
+        Header &header = headers[slot];
+        int64_t delta = static_cast<int64_t>(quantity) - header.lastQuantity;
+        if (delta == 0)
+            return;
+        now = max(now, header.lastTime);  // The clock may step back; keep times ordered
+
+        uint8_t entry[2 * MAX_VARINT_BYTES];
+        size_t length = writeVarint(entry, now - header.lastTime);
+        length += writeVarint(entry + length, zigzag(delta));
+        while (RING_BYTES - header.used < length)
+            dropOldest(header, slot);
+        uint8_t *base = &ring[slot * RING_BYTES];
+        for (size_t i = 0; i < length; ++i)
+            base[(header.head + header.used + i) % RING_BYTES] = entry[i];
+        header.used = static_cast<uint8_t>(header.used + length);
+
+        if (delta < 0) {
+            header.salesRate = decayedSales(header, now) + static_cast<float>(-delta);
+            header.rateTime = now;
+        }
+        header.lastTime = now;
+        header.lastQuantity = quantity;
+    }
+
+    // Calls visit(QuantityChange) for every change still held, oldest first;
+    // the first call is the base point the ring's deltas start from
+    template <typename Visit>
+    void forEach(uint32_t slot, Visit visit) const {
+        const Header &header = headers[slot];
+        const uint8_t *base = &ring[slot * RING_BYTES];
+        QuantityChange change{header.baseTime, header.baseQuantity};
+        visit(change);
+        for (size_t offset = 0; offset < header.used;) {
+            uint64_t seconds = readVarint(base, header.head, offset);
+            uint64_t zigzag = readVarint(base, header.head, offset);
+            change.time += static_cast<uint32_t>(seconds);
+            change.quantity += static_cast<int>(unzigzag(zigzag));
+            visit(change);
+        }
+    }
+
+    // Units sold per day over the last windowSeconds. When the history no
+    // longer reaches back that far, the rate is taken over the span it covers.
+    double salesVelocity(uint32_t slot, uint32_t now, uint32_t windowSeconds) const {
+        uint32_t since = now > windowSeconds ? now - windowSeconds : 0;
+        uint64_t sold = 0;
+        QuantityChange previous{0, 0};
+        bool first = true;
+        forEach(slot, [&](const QuantityChange &change) {
+            if (!first && change.time > since && change.quantity < previous.quantity)
+                sold += static_cast<int64_t>(previous.quantity) - change.quantity;
+            previous = change;
+            first = false;
+        });
+        uint32_t covered = now - min(now, headers[slot].baseTime);
+        double span = max(min(windowSeconds, covered), min(windowSeconds, MIN_SPAN));
+        return span > 0 ? sold * 86400.0 / span : 0.0;
+    }
+
+    // Decayed sales rate in units per day, for ranking
+    double salesRate(uint32_t slot, uint32_t now) const {
+        return decayedSales(headers[slot], now) * 86400.0 / RATE_TIME_CONSTANT;
+    }
+
+    // Bytes held for live histories, for the memory report
+    size_t payload() const {
+        return (headers.size() - freeSlots.size()) * (sizeof(Header) + RING_BYTES);
+    }
+
+private:
+    static const size_t MAX_VARINT_BYTES = 10;
+    static constexpr uint32_t MIN_SPAN = 3600;  // Keeps a brand-new item's first sale from reading as a huge rate
+
+    struct Header {
+        uint32_t baseTime;     // Point the first delta in the ring applies to
+        int32_t baseQuantity;
+        uint32_t lastTime;     // Point after the newest delta
+        int32_t lastQuantity;
+        float salesRate;       // Decayed units sold, as of rateTime
+        uint32_t rateTime;
+        uint8_t head;          // Ring offset of the oldest delta
+        uint8_t used;          // Ring bytes in use
+    };
+
+    vector<Header, TrackingAllocator<Header, MEMORY_HISTORY>> headers;
+    vector<uint8_t, TrackingAllocator<uint8_t, MEMORY_HISTORY>> ring;  // RING_BYTES per slot
+    vector<uint32_t, TrackingAllocator<uint32_t, MEMORY_HISTORY>> freeSlots;
+
+    static float decayedSales(const Header &header, uint32_t now) {
+        double age = now > header.rateTime ? now - header.rateTime : 0;
+        return static_cast<float>(header.salesRate * exp(-age / RATE_TIME_CONSTANT));
+    }
+
+    static size_t writeVarint(uint8_t *out, uint64_t value) {
+        size_t length = 0;
+        while (value >= 0x80) {
+            out[length++] = static_cast<uint8_t>(value | 0x80);
+            value >>= 7;
+        }
+        out[length++] = static_cast<uint8_t>(value);
+        return length;
+    }
+
+    // Interleaves signed values so small magnitudes of either sign stay short
+    static uint64_t zigzag(int64_t value) {
+        return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    }
+
+    static int64_t unzigzag(uint64_t value) {
+        return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    }
+
+    static uint64_t readVarint(const uint8_t *base, size_t head, size_t &offset) {
+        uint64_t value = 0;
+        for (int shift = 0;; shift += 7) {
+            uint8_t byte = base[(head + offset++) % RING_BYTES];
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+    }
+
+    // Folds the oldest delta into the base point
+    void dropOldest(Header &header, uint32_t slot) {
+        const uint8_t *base = &ring[slot * RING_BYTES];
+        size_t offset = 0;
+        uint64_t seconds = readVarint(base, header.head, offset);
+        uint64_t zigzag = readVarint(base, header.head, offset);
+        header.baseTime += static_cast<uint32_t>(seconds);
+        header.baseQuantity += static_cast<int32_t>(unzigzag(zigzag));
+        header.head = static_cast<uint8_t>((header.head + offset) % RING_BYTES);
+        header.used = static_cast<uint8_t>(header.used - offset);
+    }
+};
+
+#endif // HISTORY_H
@@ -0,0 +1,1412 @@
+#include "inventory.h"
+
+// Scan kernels compare a column against a constant and emit 64 rows per bitmap
+// word. scanColumn is instantiated per column type and predicate, so the
+// comparison is inlined and the loop stays branch-free for the compiler to
+// vectorize. The entry points below are what selectRows() calls; on x86-64
+// Linux a clone of each is built per instruction set and picked at load time.
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__linux__)
+#define SCAN_KERNEL __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define SCAN_KERNEL
+#endif
+
+template <typename Predicate, typename T>
+static inline void scanColumn(const T *column, int count, T value, uint64_t *bitmap) {
+    Predicate matches;
+    for (int base = 0; base < count; base += 64) {
+        int rows = min(64, count - base);
+        uint64_t bits = 0;
+        for (int j = 0; j < rows; ++j)
+            bits |= static_cast<uint64_t>(matches(column[base + j], value)) << j;
+        bitmap[base / 64] = bits;
+    }
+}
+
+SCAN_KERNEL
+static void scanAtMost(const int32_t *column, int count, int32_t bound, uint64_t *bitmap) {
+    scanColumn<less_equal<int32_t>>(column, count, bound, bitmap);
+}
+
+SCAN_KERNEL
+static void scanEquals(const uint8_t *column, int count, uint8_t value, uint64_t *bitmap) {
+    scanColumn<equal_to<uint8_t>>(column, count, value, bitmap);
+}
+
+const char *statusMessage(InventoryStatus status) {
+    switch (status) {
+    case STATUS_OK:
+        return "ok";
+    case STATUS_NOT_FOUND:
+        return "not found";
+    case STATUS_DUPLICATE_ID:
+        return "duplicate id";
+    case STATUS_UNKNOWN_CATEGORY:
+        return "unknown category";
+    case STATUS_INVALID_VALUE:
+        return "invalid value";
+    case STATUS_OVER_MEMORY_BUDGET:
+        return "over memory budget";
+    case STATUS_CATEGORY_LIMIT:
+        return "too many categories";
+    case STATUS_STORAGE_ERROR:
+        return "storage error";
+    case STATUS_INSUFFICIENT_STOCK:
+        return "insufficient stock";
+    case STATUS_NOT_RESERVED:
+        return "not reserved";
+    }
+    return "unknown status";
+}
+
+RowMerge::RowMerge(vector<Source> sources, uint64_t from)
+        : sources(move(sources)), positions(this->sources.size()) {
+    heads.reserve(this->sources.size());
+    for (size_t s = 0; s < this->sources.size(); ++s)
+        advance(static_cast<int>(s), this->sources[s].rows->lowerBound(from));
+}
+
+void RowMerge::next() {
+    int s = source();
+    const RowTable &rows = *sources[s].rows;
+    positions[s] = nextMatch(rows, positions[s] + 1, sources[s].matches);
+    if (positions[s] == rows.size()) {
+        pop_heap(heads.begin(), heads.end(), greater<Head>());
+        heads.pop_back();
+        return;
+    }
+    // Usually the same table stays on top, so replace the top in place and
+    // sift it down instead of popping and pushing
+    Head head(rows[positions[s]].rank, s);
+    size_t hole = 0;
+    while (true) {
+        size_t child = 2 * hole + 1;
+        if (child >= heads.size())
+            break;
+        if (child + 1 < heads.size() && heads[child + 1] < heads[child])
+            child++;
+        if (!(heads[child] < head))
+            break;
+        heads[hole] = heads[child];
+        hole = child;
+    }
+    heads[hole] = head;
+}
+
+void RowMerge::advance(int s, int cursor) {
+    const RowTable &rows = *sources[s].rows;
+    positions[s] = nextMatch(rows, cursor, sources[s].matches);
+    if (positions[s] < rows.size()) {
+        heads.emplace_back(rows[positions[s]].rank, s);
+        push_heap(heads.begin(), heads.end(), greater<Head>());
+    }
+}
+
+int RowMerge::nextMatch(const RowTable &rows, int cursor, const Selection *matches) {
+    if (!matches)
+        return min(cursor, rows.size());
+    while (cursor < rows.size() && static_cast<size_t>(cursor / 64) < matches->size()) {
+        uint64_t word = (*matches)[cursor / 64] >> (cursor % 64);
+        if (word)
+            return min(cursor + __builtin_ctzll(word), rows.size());
+        cursor = (cursor / 64 + 1) * 64;
+    }
+    return rows.size();
+}
+
+size_t RowMerge::countMatches(const RowTable &rows, const Selection *matches) {
+    if (!matches)
+        return rows.size();
+    size_t count = 0;
+    size_t words = min(matches->size(), static_cast<size_t>(rows.size() + 63) / 64);
+    for (size_t i = 0; i < words; ++i) {
+        uint64_t word = (*matches)[i];
+        if (i == static_cast<size_t>(rows.size()) / 64)
+            word &= (1ULL << (rows.size() % 64)) - 1;  // Bits past the last row
+        count += __builtin_popcountll(word);
+    }
+    return count;
+}
+
+Snapshot::iterator Snapshot::begin() const {
+    vector<RowMerge::Source> sources;
+    sources.reserve(tables.size());
+    for (size_t s = 0; s < tables.size(); ++s)
+        sources.push_back({&tables[s], selections[s].get()});
+    return iterator(RowMerge(move(sources), 0));
+}
+
+ItemManager::ItemManager(int shardCount, WorkStealingPool &pool) : pool(pool), nextRank(0), stopping(false) {
+    if (shardCount <= 0)
+        shardCount = static_cast<int>(max(thread::hardware_concurrency(), 1u));
+    shardCount = min(shardCount, MAX_SHARDS);
+    for (int i = 0; i < shardCount; ++i)
+        shards.push_back(make_unique<Shard>());
+    // Writers start once every shard exists
+    for (auto &shard : shards)
+        shard->writer = thread(&ItemManager::applyUpdates, this, ref(*shard));
+}
+
+ItemManager::~ItemManager() {
+    stopping = true;
+    for (auto &shard : shards) {
+        shard->wakeups++;
+        shard->wakeups.notify_one();
+        shard->writer.join();
+    }
+}
+
+size_t ItemManager::shardIndex(const string &id) const {
+    // Fibonacci hashing mixes the bits, so the shard says nothing about the
+    // ID's bucket in the shard's idIndex
+    uint64_t mixed = static_cast<uint64_t>(hash<string>{}(id)) * 0x9E3779B97F4A7C15ULL;
+    return (mixed >> 32) % shards.size();
+}
+
+ItemManager::Shard &ItemManager::shardOf(const string &id) const {
+    return *shards[shardIndex(id)];
+}
+
+vector<shared_lock<shared_mutex>> ItemManager::lockShared() const {
+    vector<shared_lock<shared_mutex>> locks;
+    locks.reserve(shards.size());
+    for (const auto &shard : shards)
+        locks.emplace_back(shard->rwLock);
+    return locks;
+}
+
+vector<unique_lock<shared_mutex>> ItemManager::lockExclusive() {
+    vector<unique_lock<shared_mutex>> locks;
+    locks.reserve(shards.size());
+    for (const auto &shard : shards)
+        locks.emplace_back(shard->rwLock);
+    return locks;
+}
+
+template <typename Body>
+void ItemManager::forEachShard(Body body) const {
+    pool.parallelFor(0, static_cast<int>(shards.size()), 1, [&](int begin, int end) {
+        for (int s = begin; s < end; ++s)
+            body(*shards[s], s);
+    });
+}
+
+template <typename Visit>
+void ItemManager::mergeRows(const vector<SharedSelection> &selections, uint64_t from, Visit visit) const {
+    vector<RowMerge::Source> sources;
+    sources.reserve(shards.size());
+    for (size_t s = 0; s < shards.size(); ++s)
+        sources.push_back({&shards[s]->rows, selections[s].get()});
+    for (RowMerge merge(move(sources), from); !merge.done(); merge.next()) {
+        if (!visit(merge.source(), merge.index()))
+            return;
+    }
+}
+
+vector<SharedSelection> ItemManager::selectAll(ListFilter filter, uint8_t code) {
+    vector<SharedSelection> selections(shards.size());
+    if (filter != LIST_ALL)  // LIST_ALL selections are all null
+        forEachShard([&](Shard &shard, int s) { selections[s] = selectRows(shard, filter, code); });
+    return selections;
+}
+
+InventoryStatus ItemManager::openStorage(StorageKind kind, const string &path) {
+    auto locks = lockExclusive();
+    bool opened = true;
+    if (kind == STORAGE_MAPPED)
+        opened = storage.emplace<MappedStorage>().open(path);
+    else if (kind == STORAGE_LSM)
+        opened = storage.emplace<LogStructuredStorage>().open(path);
+    else
+        storage.emplace<MemoryStorage>();
+    if (!opened)
+        return STATUS_STORAGE_ERROR;
+
+    bool valid = true;
+    bool loaded = visit([&](auto &backend) {
+        return backend.load([&](const string &id, const string &name, int quantity, double price,
+                                const string &category) {
+            uint8_t code = categories.define(category);
+            Shard &shard = shardOf(id);
+            if (code == NO_CATEGORY || shard.indexOfId(id) != -1) {
+                valid = false;
+                return;
+            }
+            appendVersion(shard, newVersion(id, name, quantity, price, category), code);
+        });
+    }, storage);
+    return loaded && valid ? STATUS_OK : STATUS_STORAGE_ERROR;
+}
+
+InventoryStatus ItemManager::add(const string &id, const string &name, int quantity, double price,
+                                 const string &category) {
+    OperationTimer timer(metrics, METRIC_ADD);
+    TRACE_SPAN("addItem");
+    uint8_t code = categoryCode(category);
+    if (code == NO_CATEGORY)
+        return STATUS_UNKNOWN_CATEGORY;
+    if (quantity < 0 || !(price >= 0) || isinf(price))
+        return STATUS_INVALID_VALUE;  // Also rejects NaN, as update() does
+
+    Shard &shard = shardOf(id);
+    unique_lock<shared_mutex> lock(shard.rwLock);
+    if (shard.indexOfId(id) != -1)
+        return STATUS_DUPLICATE_ID;
+    if (MemoryTracker::overBudget()) {
+        spillQueryCache();
+        if (MemoryTracker::overBudget())
+            return STATUS_OVER_MEMORY_BUDGET;
+    }
+    auto version = newVersion(id, name, quantity, price, categories.name(code));
+    if (!persist(*version))
+        return STATUS_STORAGE_ERROR;
+    metrics.addAllocated(METRIC_ADD, itemBytes(*version));
+    appendVersion(shard, move(version), code);
+    timer.done(true);
+    return STATUS_OK;
+}
+
+InventoryStatus ItemManager::find(const string &id, ItemView &view) const {
+    OperationTimer timer(metrics, METRIC_LOOKUP_ID);
+    const Shard &shard = shardOf(id);
+    shared_lock<shared_mutex> lock(shard.rwLock);
+    int index = shard.indexOfId(id);
+    if (!timer.done(index != -1))
+        return STATUS_NOT_FOUND;
+    view = shard.rows[index].item;
+    return STATUS_OK;
+}
+
+InventoryStatus ItemManager::findByName(const string &name, ItemView &view) const {
+    OperationTimer timer(metrics, METRIC_LOOKUP_NAME);
+    auto locks = lockShared();
+    // Every shard looks for its first match; the one ranked first wins
+    vector<int> matches(shards.size());
+    forEachShard([&](Shard &shard, int s) { matches[s] = indexOfName(shard, name); });
+    const Shard *found = nullptr;
+    int index = -1;
+    for (size_t s = 0; s < shards.size(); ++s) {
+        const Shard &shard = *shards[s];
+        if (matches[s] != -1 && (!found || shard.rows[matches[s]].rank < found->rows[index].rank)) {
+            found = &shard;
+            index = matches[s];
+        }
+    }
+    if (!timer.done(found != nullptr))
+        return STATUS_NOT_FOUND;
+    view = found->rows[index].item;
+    return STATUS_OK;
+}
+
+InventoryStatus ItemManager::update(const string &id, UpdateField field, double value) {
+    OperationTimer timer(metrics, METRIC_UPDATE);
+    Shard &shard = shardOf(id);
+    unique_lock<shared_mutex> lock(shard.rwLock);
+    InventoryStatus status = applyUpdate(shard, id, field, value);
+    if (status != STATUS_OK)
+        return status;
+    if (field == UPDATE_QUANTITY)
+        shard.quantityGeneration++;
+    else
+        shard.priceGeneration++;
+    timer.done(true);
+    return STATUS_OK;
+}
+
+InventoryStatus ItemManager::remove(const string &id, ItemView *removed) {
+    OperationTimer timer(metrics, METRIC_REMOVE);
+    TRACE_SPAN("removeItem");
+    Shard &shard = shardOf(id);
+    unique_lock<shared_mutex> lock(shard.rwLock);
+    int index = shard.indexOfId(id);
+    if (index == -1)
+        return STATUS_NOT_FOUND;
+    if (!persistRemoval(id))
+        return STATUS_STORAGE_ERROR;
+    if (removed)
+        *removed = shard.rows[index].item;
+
+    // Shift the shard's remaining items to fill the gap
+    shard.idIndex.erase(id);
+    shard.rows.erase(index);
+    shard.quantities.erase(shard.quantities.begin() + index);
+    shard.categoryCodes.erase(shard.categoryCodes.begin() + index);
+    shard.reservations.erase(shard.reservations.begin() + index);
+    shard.history.release(shard.historySlots[index]);
+    shard.historySlots.erase(shard.historySlots.begin() + index);
+    {
+        TRACE_SPAN("reindex");
+        for (int i = index; i < shard.rows.size(); ++i)
+            shard.idIndex[shard.rows[i].item->getId()] = i;
+    }
+    shard.layoutGeneration++;
+    timer.done(true);
+    return STATUS_OK;
+}
+
+InventoryStatus ItemManager::query(const ListQuery &query, Snapshot &rows) {
+    OperationTimer timer(metrics, METRIC_LIST);
+    TRACE_SPAN("query");
+    uint8_t code = categoryCode(query.category);
+    if (query.filter == LIST_CATEGORY && code == NO_CATEGORY)
+        return STATUS_UNKNOWN_CATEGORY;
+
+    rows = Snapshot();
+    {
+        auto locks = lockShared();
+        rows.selections = selectAll(query.filter, code);
+        rows.tables.reserve(shards.size());
+        for (const auto &shard : shards)
+            rows.tables.push_back(shard->rows);
+    }
+    // Pinned tables no longer change, so counting needs no lock
+    for (size_t s = 0; s < rows.tables.size(); ++s)
+        rows.count += RowMerge::countMatches(rows.tables[s], rows.selections[s].get());
+    timer.done(true);
+    return STATUS_OK;
+}
+
+int64_t ItemManager::listItems(const ListQuery &query, int64_t cursor, int limit, vector<ItemView> &page) {
+    OperationTimer timer(metrics, METRIC_LIST);
+    TRACE_SPAN("listItems");
+    auto locks = lockShared();
+    vector<SharedSelection> selections = selectAll(query.filter, categoryCode(query.category));
+    int64_t next = -1;
+    int copied = 0;
+    mergeRows(selections, static_cast<uint64_t>(max<int64_t>(cursor, 0)), [&](int shard, int index) {
+        if (copied == limit) {
+            next = static_cast<int64_t>(shards[shard]->rows[index].rank);
+            return false;
+        }
+        page.push_back(shards[shard]->rows[index].item);
+        copied++;
+        return true;
+    });
+    timer.done(true);
+    return next;
+}
+
+future<InventoryStatus> ItemManager::submitUpdate(const string &id, UpdateField field, double value) {
+    Shard &shard = shardOf(id);
+    UpdateCommand command{field, id, value, promise<InventoryStatus>()};
+    future<InventoryStatus> result = command.done.get_future();
+    while (!shard.updates.tryPush(move(command)))
+        this_thread::yield();  // Queue full, wait for the writer to catch up
+    wakeWriter(shard);
+    return result;
+}
+
+InventoryStatus ItemManager::applyQuantityDeltas(const vector<pair<string, int>> &deltas, string *failedId) {
+    OperationTimer timer(metrics, METRIC_DELTAS);
+    TRACE_SPAN("applyQuantityDeltas");
+    // Group by ID before taking the locks
+    vector<pair<string, long long>> grouped(deltas.begin(), deltas.end());
+    sort(grouped.begin(), grouped.end(),
+         [](const pair<string, long long> &a, const pair<string, long long> &b) { return a.first < b.first; });
+    size_t unique = 0;
+    for (size_t i = 0; i < grouped.size(); ++i) {
+        if (unique > 0 && grouped[unique - 1].first == grouped[i].first)
+            grouped[unique - 1].second += grouped[i].second;
+        else if (unique++ != i)
+            grouped[unique - 1] = move(grouped[i]);
+    }
+    grouped.resize(unique);
+
+    // Lock only the shards the batch touches, in shard order
+    vector<int> owners(grouped.size());
+    for (size_t i = 0; i < grouped.size(); ++i)
+        owners[i] = shardIndex(grouped[i].first);
+    vector<int> touched(owners);
+    sort(touched.begin(), touched.end());
+    touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+    vector<unique_lock<shared_mutex>> locks;
+    for (int s : touched)
+        locks.emplace_back(shards[s]->rwLock);
+
+    vector<tuple<int, int, long long>> changes;  // (shard, index, delta)
+    changes.reserve(grouped.size());
+    auto fail = [&](InventoryStatus status, const string &id) {
+        if (failedId)
+            *failedId = id;
+        return status;
+    };
+    for (size_t i = 0; i < grouped.size(); ++i) {
+        int index = shards[owners[i]]->indexOfId(grouped[i].first);
+        if (index == -1)
+            return fail(STATUS_NOT_FOUND, grouped[i].first);
+        changes.emplace_back(owners[i], index, grouped[i].second);
+    }
+    sort(changes.begin(), changes.end());
+
+    // Validate everything before changing anything; stock held by open
+    // checkouts cannot be sold off
+    for (const auto &[s, index, delta] : changes) {
+        const Shard &shard = *shards[s];
+        long long quantity = shard.quantities[index] + delta;
+        if (quantity < shard.reservations[index]->units)
+            return fail(STATUS_INSUFFICIENT_STOCK, shard.rows[index].item->getId());
+        if (quantity > INT32_MAX)
+            return fail(STATUS_INVALID_VALUE, shard.rows[index].item->getId());
+    }
+
+    // Build every new version and write them through as one batch before
+    // installing any, so a failed write leaves the batch unapplied
+    vector<shared_ptr<Item>> versions;
+    versions.reserve(changes.size());
+    for (const auto &[s, index, delta] : changes) {
+        const Shard &shard = *shards[s];
+        versions.push_back(newVersion(*shard.rows[index].item));
+        versions.back()->setQuantity(static_cast<int>(shard.quantities[index] + delta));
+    }
+    bool written = writeThrough([&](auto &backend) {
+        for (const auto &version : versions)
+            backend.put(version->getId(), version->getName(), version->getQuantity(), version->getPrice(),
+                        version->getCategory());
+    });
+    if (!written)
+        return STATUS_STORAGE_ERROR;
+
+    uint32_t now = historyTime();
+    for (size_t i = 0; i < changes.size(); ++i) {
+        auto [s, index, delta] = changes[i];
+        Shard &shard = *shards[s];
+        metrics.addAllocated(METRIC_DELTAS, itemBytes(*versions[i]));
+        shard.history.record(shard.historySlots[index], now, versions[i]->getQuantity());
+        shard.rows.mutableRow(index).item = move(versions[i]);
+        syncColumns(shard, index);
+    }
+    for (int s : touched)
+        shards[s]->quantityGeneration++;
+    timer.done(true);
+    return STATUS_OK;
+}
+
+InventoryStatus ItemManager::reserve(const string &id, int units) {
+    OperationTimer timer(metrics, METRIC_RESERVE);
+    if (units <= 0)
+        return STATUS_INVALID_VALUE;
+    Shard &shard = shardOf(id);
+    shared_lock<shared_mutex> lock(shard.rwLock);
+    int index = shard.indexOfId(id);
+    if (index == -1)
+        return STATUS_NOT_FOUND;
+
+    // The quantity cannot change while the shared lock is held
+    atomic<int> &reserved = shard.reservations[index]->units;
+    int current = reserved.load();
+    do {
+        if (units > shard.quantities[index] - current)
+            return STATUS_INSUFFICIENT_STOCK;
+    } while (!reserved.compare_exchange_weak(current, current + units));
+    timer.done(true);
+    return STATUS_OK;
+}
+
+InventoryStatus ItemManager::release(const string &id, int units) {
+    OperationTimer timer(metrics, METRIC_RELEASE);
+    if (units <= 0)
+        return STATUS_INVALID_VALUE;
+    Shard &shard = shardOf(id);
+    shared_lock<shared_mutex> lock(shard.rwLock);
+    int index = shard.indexOfId(id);
+    if (index == -1)
+        return STATUS_NOT_FOUND;
+    if (!takeReserved(*shard.reservations[index], units))
+        return STATUS_NOT_RESERVED;
+    timer.done(true);
+    return STATUS_OK;
+}
+
+InventoryStatus ItemManager::commit(const string &id, int units) {
+    OperationTimer timer(metrics, METRIC_COMMIT);
+    if (units <= 0)
+        return STATUS_INVALID_VALUE;
+    Shard &shard = shardOf(id);
+    unique_lock<shared_mutex> lock(shard.rwLock);
+    int index = shard.indexOfId(id);
+    if (index == -1)
+        return STATUS_NOT_FOUND;
+    if (!takeReserved(*shard.reservations[index], units))
+        return STATUS_NOT_RESERVED;
+
+    auto version = newVersion(*shard.rows[index].item);
+    version->setQuantity(shard.quantities[index] - units);
+    if (!persist(*version)) {
+        shard.reservations[index]->units += units;  // Still held by the checkout
+        return STATUS_STORAGE_ERROR;
+    }
+    metrics.addAllocated(METRIC_COMMIT, itemBytes(*version));
+    shard.history.record(shard.historySlots[index], historyTime(), version->getQuantity());
+    shard.rows.mutableRow(index).item = move(version);
+    syncColumns(shard, index);
+    shard.quantityGeneration++;
+    timer.done(true);
+    return STATUS_OK;
+}
+
+int ItemManager::reservedUnits(const string &id) const {
+    const Shard &shard = shardOf(id);
+    shared_lock<shared_mutex> lock(shard.rwLock);
+    int index = shard.indexOfId(id);
+    return index == -1 ? 0 : shard.reservations[index]->units.load();
+}
+
+InventoryStatus ItemManager::quantityHistory(const string &id, vector<QuantityChange> &changes) const {
+    const Shard &shard = shardOf(id);
+    shared_lock<shared_mutex> lock(shard.rwLock);
+    int index = shard.indexOfId(id);
+    if (index == -1)
+        return STATUS_NOT_FOUND;
+    changes.clear();
+    shard.history.forEach(shard.historySlots[index], [&](const QuantityChange &change) { changes.push_back(change); });
+    return STATUS_OK;
+}
+
+InventoryStatus ItemManager::salesVelocity(const string &id, double windowDays, double &unitsPerDay) const {
+    if (!(windowDays > 0))
+        return STATUS_INVALID_VALUE;
+    uint32_t window = static_cast<uint32_t>(min(windowDays * 86400, static_cast<double>(UINT32_MAX)));
+    const Shard &shard = shardOf(id);
+    shared_lock<shared_mutex> lock(shard.rwLock);
+    int index = shard.indexOfId(id);
+    if (index == -1)
+        return STATUS_NOT_FOUND;
+    unitsPerDay = shard.history.salesVelocity(shard.historySlots[index], historyTime(), max(window, 1u));
+    return STATUS_OK;
+}
+
+void ItemManager::topMovers(int count, vector<pair<ItemView, double>> &movers) const {
+    TRACE_SPAN("topMovers");
+    movers.clear();
+    auto locks = lockShared();
+    // Every shard reads its items' decayed rates in parallel, then the top
+    // count is selected without sorting the rest
+    uint32_t now = historyTime();
+    vector<vector<tuple<float, int, int>>> shardSelling(shards.size());  // (rate, shard, index)
+    forEachShard([&](Shard &shard, int s) {
+        for (int i = 0; i < shard.rows.size(); ++i) {
+            float rate = static_cast<float>(shard.history.salesRate(shard.historySlots[i], now));
+            if (rate > 0)
+                shardSelling[s].emplace_back(rate, s, i);
+        }
+    });
+    vector<tuple<float, int, int>> selling;
+    for (const auto &rates : shardSelling)
+        selling.insert(selling.end(), rates.begin(), rates.end());
+    auto faster = [](const tuple<float, int, int> &a, const tuple<float, int, int> &b) {
+        return get<0>(a) > get<0>(b);
+    };
+    if (count < static_cast<int>(selling.size())) {
+        nth_element(selling.begin(), selling.begin() + max(count, 0), selling.end(), faster);
+        selling.resize(max(count, 0));
+    }
+    sort(selling.begin(), selling.end(), faster);
+    for (const auto &[rate, s, index] : selling)
+        movers.emplace_back(shards[s]->rows[index].item, rate);
+}
+
+void ItemManager::sortBy(const vector<SortKey> &keys) {
+    OperationTimer timer(metrics, METRIC_SORT);
+    TRACE_SPAN("sortBy");
+    timer.done(true);
+    auto locks = lockExclusive();
+    // Nothing to do if the items are still in the order this sort last
+    // produced. Generations only grow, so the sums over the shards change
+    // whenever any shard's do.
+    auto generations = [&] {
+        pair<uint64_t, uint64_t> sums(0, 0);  // (layout, column)
+        for (const auto &shard : shards) {
+            sums.first += shard->layoutGeneration;
+            for (int i = 0; i < categories.size(); ++i)
+                sums.second += shard->categoryGenerations[i];  // Counts added rows
+            for (const SortKey &key : keys) {
+                if (key.field == SORT_QUANTITY)
+                    sums.second += shard->quantityGeneration;
+                else if (key.field == SORT_PRICE)
+                    sums.second += shard->priceGeneration;
+            }
+        }
+        return sums;
+    };
+    int itemCount = 0;
+    for (const auto &shard : shards)
+        itemCount += shard->rows.size();
+    if (itemCount < 2)
+        return;  // Already in any order; the passes also assume a first row
+    string queryKey = "SORT:";
+    for (const SortKey &key : keys) {
+        queryKey += static_cast<char>('0' + key.field);
+        queryKey += key.ascending ? 'A' : 'D';
+    }
+    CachedQuery &cached = sortCache[queryKey];
+    auto current = generations();
+    if (cached.layoutGeneration == current.first && cached.columnGeneration == current.second)
+        return;
+
+    // Gather every row in the current order, sort them together, then hand
+    // each shard its rows back in the new order
+    SortRows rows;
+    vector<pair<int, int>> origins;  // (shard, index) of each gathered row
+    rows.items.reserve(itemCount);
+    rows.codes.reserve(itemCount);
+    origins.reserve(itemCount);
+    mergeRows(vector<SharedSelection>(shards.size()), 0, [&](int s, int index) {
+        rows.items.push_back(shards[s]->rows[index].item.get());
+        rows.codes.push_back(shards[s]->categoryCodes[index]);
+        origins.emplace_back(s, index);
+        return true;
+    });
+    vector<int> order = sortedOrder(rows, keys);
+    metrics.addScanned(METRIC_SORT, static_cast<uint64_t>(itemCount) * keys.size());
+    bool moved = false;
+    for (int i = 0; i < itemCount && !moved; ++i)
+        moved = order[i] != i;
+    if (moved) {
+        TRACE_SPAN("reorder");
+        // Ranks restart at 0 in the new order
+        vector<vector<int>> shardOrders(shards.size());
+        vector<vector<uint64_t>> shardRanks(shards.size());
+        for (int position = 0; position < itemCount; ++position) {
+            auto [s, index] = origins[order[position]];
+            shardOrders[s].push_back(index);
+            shardRanks[s].push_back(position);
+        }
+        forEachShard([&](Shard &shard, int s) {
+            const vector<int> &shardOrder = shardOrders[s];
+            int count = shard.rows.size();
+            RowTable sorted;  // A new table; snapshots keep the old one
+            decltype(shard.reservations) sortedReservations(count);
+            decltype(shard.historySlots) sortedSlots(count);
+            for (int i = 0; i < count; ++i) {
+                sorted.push_back({shard.rows[shardOrder[i]].item, shardRanks[s][i]});
+                sortedReservations[i] = move(shard.reservations[shardOrder[i]]);
+                sortedSlots[i] = shard.historySlots[shardOrder[i]];
+            }
+            shard.rows = move(sorted);
+            shard.reservations.swap(sortedReservations);
+            shard.historySlots.swap(sortedSlots);
+            for (int i = 0; i < count; ++i) {
+                syncColumns(shard, i);
+                shard.idIndex[shard.rows[i].item->getId()] = i;
+            }
+            shard.layoutGeneration++;
+        });
+        nextRank = itemCount;
+        current = generations();
+    }
+    cached.layoutGeneration = current.first;
+    cached.columnGeneration = current.second;
+}
+
+bool ItemManager::isEmpty() const {
+    for (const auto &shard : shards) {
+        shared_lock<shared_mutex> lock(shard->rwLock);
+        if (shard->rows.size() > 0)
+            return false;
+    }
+    return true;
+}
+
+bool ItemManager::isValidCategory(const string &category) const {
+    return categoryCode(category) != NO_CATEGORY;
+}
+
+uint8_t ItemManager::categoryCode(const string &category) const {
+    return categories.find(category);
+}
+
+InventoryStatus ItemManager::defineCategory(const string &category) {
+    if (categories.define(category) != NO_CATEGORY)
+        return STATUS_OK;
+    return categories.size() == CategoryDictionary::CAPACITY ? STATUS_CATEGORY_LIMIT : STATUS_INVALID_VALUE;
+}
+
+int ItemManager::categoryCount() const {
+    return categories.size();
+}
+
+const string &ItemManager::categoryName(uint8_t code) const {
+    return categories.name(code);
+}
+
+void ItemManager::writeMemoryReport(ostream &out) {
+    auto locks = lockShared();
+    size_t payload[MEMORY_COMPONENT_COUNT] = {};
+    int itemCount = 0;
+    for (const auto &shard : shards) {
+        itemCount += shard->rows.size();
+        for (int i = 0; i < shard->rows.size(); ++i)
+            payload[MEMORY_STRINGS] += shard->rows[i].item->getStringPayload();
+        payload[MEMORY_ID_INDEX] += shard->idIndex.size() * sizeof(pair<const string, int>);
+        payload[MEMORY_HISTORY] += shard->history.payload();
+        lock_guard<mutex> cacheGuard(shard->cacheLock);
+        for (const auto &entry : shard->queryCache)
+            payload[MEMORY_QUERY_CACHE] +=
+                    sizeof(entry) + (entry.second.matches ? entry.second.matches->size() * sizeof(uint64_t) : 0);
+    }
+    payload[MEMORY_ITEMS] = itemCount * (sizeof(RowTable::Row) + sizeof(Item));
+    payload[MEMORY_COLUMNS] = itemCount * (sizeof(int32_t) + sizeof(uint8_t) + sizeof(atomic<int>) + sizeof(uint32_t));
+    for (const auto &entry : sortCache)
+        payload[MEMORY_QUERY_CACHE] += sizeof(entry);
+    out << left << setw(14) << "Component" << right << setw(14) << "Bytes" << setw(10) << "Blocks"
+        << setw(12) << "Bytes/item" << setw(14) << "Peak" << setw(16) << "Fragmentation" << endl;
+    int64_t totalBytes = 0, totalBlocks = 0;
+    size_t totalPayload = 0;
+    auto row = [&](const char *name, int64_t bytes, int64_t blocks, int64_t peak, size_t used) {
+        double fragmentation = bytes > 0 ? max(0.0, 1.0 - static_cast<double>(used) / bytes) : 0.0;
+        out << left << setw(14) << name << right << setw(14) << bytes << setw(10) << blocks << setw(12) << fixed
+            << setprecision(1) << (itemCount ? static_cast<double>(bytes) / itemCount : 0.0) << setw(14);
+        if (peak >= 0)
+            out << peak;
+        else
+            out << "-";
+        out << setw(15) << setprecision(1) << fragmentation * 100 << "%" << endl;
+    };
+    for (int component = 0; component < MEMORY_COMPONENT_COUNT; ++component) {
+        const MemoryAccount &account = MemoryTracker::account(static_cast<MemoryComponent>(component));
+        int64_t bytes = account.bytes.load();
+        row(memoryComponentName(static_cast<MemoryComponent>(component)), bytes, account.blocks.load(),
+            account.peak.load(), payload[component]);
+        totalBytes += bytes;
+        totalBlocks += account.blocks.load();
+        totalPayload += payload[component];
+    }
+    row("total", totalBytes, totalBlocks, -1, totalPayload);
+
+    int64_t budget = MemoryTracker::getBudget();
+    if (budget > 0)
+        out << "Budget: " << budget << " bytes, " << setprecision(1) << 100.0 * totalBytes / budget << "% used"
+            << endl;
+    else
+        out << "Budget: unlimited" << endl;
+}
+
+vector<int> ItemManager::sortedOrder(const SortRows &rows, const vector<SortKey> &keys) {
+    vector<int> order(rows.items.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = static_cast<int>(i);
+
+    for (auto key = keys.rbegin(); key != keys.rend(); ++key)
+        (this->*SORT_PASSES[key->field - 1][key->ascending])(rows, order);
+    return order;
+}
+
+const ItemManager::SortPass ItemManager::SORT_PASSES[SORT_CATEGORY][2] = {
+    {&ItemManager::radixSortByNumber<SORT_QUANTITY, false>, &ItemManager::radixSortByNumber<SORT_QUANTITY, true>},
+    {&ItemManager::radixSortByNumber<SORT_PRICE, false>, &ItemManager::radixSortByNumber<SORT_PRICE, true>},
+    {&ItemManager::sortByText<SORT_NAME, false>, &ItemManager::sortByText<SORT_NAME, true>},
+    {&ItemManager::sortByText<SORT_ID, false>, &ItemManager::sortByText<SORT_ID, true>},
+    {&ItemManager::sortByCategory<false>, &ItemManager::sortByCategory<true>},
+};
+
+template <SortField Field>
+uint64_t ItemManager::normalizedKey(const Item *item) {
+    static_assert(Field == SORT_QUANTITY || Field == SORT_PRICE);
+    if constexpr (Field == SORT_QUANTITY) {
+        return static_cast<uint32_t>(item->getQuantity()) ^ 0x80000000u;
+    } else {
+        double price = item->getPrice();
+        uint64_t bits;
+        memcpy(&bits, &price, sizeof bits);
+        return (bits >> 63) ? ~bits : bits | (1ULL << 63);
+    }
+}
+
+template <SortField Field, bool Ascending>
+void ItemManager::radixSortByNumber(const SortRows &rows, vector<int> &order) {
+    TRACE_SPAN("radixSort");
+    int count = static_cast<int>(rows.items.size());
+    vector<uint64_t> values(count);
+    pool.parallelFor(0, count, PARALLEL_GRAIN, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i)
+            values[i] = Ascending ? normalizedKey<Field>(rows.items[i]) : ~normalizedKey<Field>(rows.items[i]);
+    });
+
+    // Descending quantity keys have their upper half set, which no pass reads
+    const int bytes = (Field == SORT_QUANTITY) ? 4 : 8;
+    vector<int> buffer(order.size());
+    for (int pass = 0; pass < bytes; ++pass) {
+        int shift = pass * 8;
+        size_t counts[257] = {0};
+        for (int index : order)
+            counts[((values[index] >> shift) & 0xFF) + 1]++;
+
+        // Skip passes where every key has the same byte
+        if (counts[((values[order[0]] >> shift) & 0xFF) + 1] == order.size())
+            continue;
+
+        for (int b = 0; b < 256; ++b)
+            counts[b + 1] += counts[b];
+        for (int index : order)
+            buffer[counts[(values[index] >> shift) & 0xFF]++] = index;
+        order.swap(buffer);
+    }
+}
+
+// Stable MSD radix sort of order[0, count) on the bytes of values from depth
+// on. Each level distributes by one byte into 257 buckets, with bucket 0 for
+// keys that end at depth, so byte order matches string's operator<. Equal
+// keys keep their relative order. buffer and buckets are scratch of the
+// same length as order. With a pool, the buckets of the first level that
+// splits are sorted as parallel tasks.
+//
+// Every bucket but the largest is sorted by a recursive call and the largest
+// by the next iteration, so the stack stays O(log count) deep however long
+// the shared prefixes. Past TEXT_RADIX_DEPTH bytes the rest of a range is
+// sorted by comparing suffixes instead.
+static const int TEXT_INSERTION_LIMIT = 32;
+static const size_t TEXT_RADIX_DEPTH = 64;
+
+template <bool Ascending>
+static void radixSortText(const vector<string> &values, int *order, int *buffer, uint16_t *buckets, int count,
+                          size_t depth, WorkStealingPool *pool = nullptr) {
+    auto suffixLess = [&](int a, int b) {
+        int cmp = values[a].compare(depth, string::npos, values[b], depth, string::npos);
+        return Ascending ? cmp < 0 : cmp > 0;
+    };
+    while (count > TEXT_INSERTION_LIMIT) {
+        if (depth >= TEXT_RADIX_DEPTH) {
+            stable_sort(order, order + count, suffixLess);
+            return;
+        }
+        size_t counts[258] = {0};
+        for (int i = 0; i < count; ++i) {
+            const string &value = values[order[i]];
+            int bucket = depth < value.size() ? static_cast<uint8_t>(value[depth]) + 1 : 0;
+            buckets[i] = static_cast<uint16_t>(Ascending ? bucket : 256 - bucket);
+            counts[buckets[i] + 1]++;
+        }
+        int endBucket = Ascending ? 0 : 256;
+        if (counts[buckets[0] + 1] == static_cast<size_t>(count)) {
+            if (buckets[0] == endBucket)
+                return;  // All keys are equal
+            depth++;     // Shared byte; no need to move anything
+            continue;
+        }
+        for (int b = 0; b < 257; ++b)
+            counts[b + 1] += counts[b];
+        for (int i = 0; i < count; ++i)
+            buffer[counts[buckets[i]]++] = order[i];
+        copy(buffer, buffer + count, order);
+
+        // counts[b] is now where bucket b ends; keys that ended are done
+        auto bucketBegin = [&](int b) { return b ? static_cast<int>(counts[b - 1]) : 0; };
+        auto sortBuckets = [&](int first, int last, int skip) {
+            for (int b = first; b < last; ++b) {
+                int begin = bucketBegin(b);
+                int size = static_cast<int>(counts[b]) - begin;
+                if (b != endBucket && b != skip && size > 1)
+                    radixSortText<Ascending>(values, order + begin, buffer + begin, buckets + begin, size, depth + 1);
+            }
+        };
+        if (pool) {
+            pool->parallelFor(0, 257, 1, [&](int first, int last) { sortBuckets(first, last, -1); });
+            return;
+        }
+        int largest = -1;
+        for (int b = 0; b < 257; ++b) {
+            if (b != endBucket && (largest == -1 || counts[b] - bucketBegin(b) > counts[largest] - bucketBegin(largest)))
+                largest = b;
+        }
+        sortBuckets(0, 257, largest);
+        int begin = bucketBegin(largest);
+        order += begin;
+        buffer += begin;
+        buckets += begin;
+        count = static_cast<int>(counts[largest]) - begin;
+        depth++;
+    }
+
+    // Stable insertion sort on the remaining suffixes
+    for (int i = 1; i < count; ++i) {
+        int index = order[i];
+        int j = i;
+        for (; j > 0 && suffixLess(index, order[j - 1]); --j)
+            order[j] = order[j - 1];
+        order[j] = index;
+    }
+}
+
+template <SortField Field, bool Ascending>
+void ItemManager::sortByText(const SortRows &rows, vector<int> &order) {
+    static_assert(Field == SORT_NAME || Field == SORT_ID);
+    TRACE_SPAN("textSort");
+    // Copies rather than views: short keys then sit inline in values, which
+    // the radix passes read once per byte
+    int count = static_cast<int>(rows.items.size());
+    vector<string> values(count);
+    pool.parallelFor(0, count, PARALLEL_GRAIN, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            if constexpr (Field == SORT_NAME)
+                values[i] = toUpperCase(rows.items[i]->getName());
+            else
+                values[i] = rows.items[i]->getId();
+        }
+    });
+
+    vector<int> buffer(count);
+    vector<uint16_t> buckets(count);
+    radixSortText<Ascending>(values, order.data(), buffer.data(), buckets.data(), count, 0,
+                             count >= PARALLEL_GRAIN ? &pool : nullptr);
+}
+
+template <bool Ascending>
+void ItemManager::sortByCategory(const SortRows &rows, vector<int> &order) {
+    TRACE_SPAN("categorySort");
+    // Rank each code by its name, then counting-sort on the category column
+    const int categoryCount = categories.size();
+    uint8_t codes[CategoryDictionary::CAPACITY];
+    for (int code = 0; code < categoryCount; ++code)
+        codes[code] = static_cast<uint8_t>(code);
+    sort(codes, codes + categoryCount, [this](uint8_t a, uint8_t b) {
+        return Ascending ? categories.name(a) < categories.name(b) : categories.name(b) < categories.name(a);
+    });
+    uint8_t rank[CategoryDictionary::CAPACITY];
+    for (int position = 0; position < categoryCount; ++position)
+        rank[codes[position]] = static_cast<uint8_t>(position);
+
+    size_t counts[CategoryDictionary::CAPACITY + 1] = {0};
+    for (int index : order)
+        counts[rank[rows.codes[index]] + 1]++;
+    for (int r = 0; r < categoryCount; ++r)
+        counts[r + 1] += counts[r];
+    vector<int> buffer(order.size());
+    for (int index : order)
+        buffer[counts[rank[rows.codes[index]]]++] = index;
+    order.swap(buffer);
+}
+
+template <typename Stage>
+bool ItemManager::writeThrough(Stage stage) {
+    return visit([&](auto &backend) {
+        if constexpr (!remove_reference_t<decltype(backend)>::PERSISTENT) {
+            return true;  // Nothing to write, so no need to serialize the shards
+        } else {
+            lock_guard<mutex> guard(storageLock);
+            stage(backend);
+            return backend.flush();
+        }
+    }, storage);
+}
+
+bool ItemManager::persist(const Item &item) {
+    return writeThrough([&](auto &backend) {
+        backend.put(item.getId(), item.getName(), item.getQuantity(), item.getPrice(), item.getCategory());
+    });
+}
+
+bool ItemManager::persistRemoval(const string &id) {
+    return writeThrough([&](auto &backend) { backend.erase(id); });
+}
+
+void ItemManager::appendVersion(Shard &shard, shared_ptr<const Item> version, uint8_t code) {
+    int index = shard.rows.size();
+    shard.idIndex[version->getId()] = index;
+    shard.rows.push_back({move(version), nextRank++});
+    shard.quantities.push_back(0);
+    shard.categoryCodes.push_back(0);
+    shard.reservations.push_back(make_unique<Reservation>());
+    shard.historySlots.push_back(shard.history.allocate(historyTime(), shard.rows[index].item->getQuantity()));
+    syncColumns(shard, index);
+    shard.quantityGeneration++;
+    shard.categoryGenerations[code]++;
+}
+
+uint32_t ItemManager::historyTime() {
+    return static_cast<uint32_t>(chrono::duration_cast<chrono::seconds>(
+            chrono::system_clock::now().time_since_epoch()).count());
+}
+
+int ItemManager::indexOfName(const Shard &shard, const string &name) const {
+    for (int i = 0; i < shard.rows.size(); ++i) {
+        if (equalsIgnoreCase(shard.rows[i].item->getName(), name)) {
+            metrics.addScanned(METRIC_LOOKUP_NAME, i + 1);
+            return i;
+        }
+    }
+    metrics.addScanned(METRIC_LOOKUP_NAME, shard.rows.size());
+    return -1;
+}
+
+uint64_t ItemManager::itemBytes(const Item &item) {
+    const size_t inlineCapacity = string().capacity();
+    uint64_t bytes = sizeof(Item);
+    for (const string *text : {&item.getId(), &item.getName(), &item.getCategory()}) {
+        if (text->capacity() > inlineCapacity)
+            bytes += text->capacity() + 1;
+    }
+    return bytes;
+}
+
+template <typename Scan>
+SharedSelection ItemManager::cachedSelection(Shard &shard, const string &queryKey, uint64_t columnGeneration,
+                                             Scan scan) {
+    size_t words = (shard.rows.size() + 63) / 64;
+    // The caller holds the shard's lock, so the generations stay put throughout
+    auto current = [&](const CachedQuery &cached) {
+        return cached.matches && cached.layoutGeneration == shard.layoutGeneration &&
+               cached.columnGeneration == columnGeneration;
+    };
+    bool keep = true;
+    {
+        lock_guard<mutex> cacheGuard(shard.cacheLock);
+        if (MemoryTracker::overBudget(words * sizeof(uint64_t))) {
+            // No room to keep results: drop the cache and scan for this query only
+            shard.queryCache.clear();
+            keep = false;
+        } else {
+            auto found = shard.queryCache.find(queryKey);
+            if (found != shard.queryCache.end() && current(found->second))
+                return found->second.matches;
+        }
+    }
+
+    // Scan without cacheLock: the scan runs on the pool, and a thread waiting
+    // for it may pick up another query's scan of this shard, which takes the
+    // lock too. A new bitmap rather than an in-place rescan: other readers may
+    // still hold the old one.
+    SharedSelection matches;
+    {
+        TRACE_SPAN("scan");
+        auto bitmap = allocate_shared<Selection>(TrackingAllocator<Selection, MEMORY_QUERY_CACHE>(), words, 0);
+        scan(bitmap->data());
+        metrics.addScanned(METRIC_LIST, shard.rows.size());
+        matches = move(bitmap);
+    }
+    if (!keep)
+        return matches;
+    lock_guard<mutex> cacheGuard(shard.cacheLock);
+    CachedQuery &cached = shard.queryCache[queryKey];
+    if (current(cached))
+        return cached.matches;  // Another reader scanned it meanwhile
+    cached.matches = matches;
+    cached.layoutGeneration = shard.layoutGeneration;
+    cached.columnGeneration = columnGeneration;
+    return matches;
+}
+
+void ItemManager::spillQueryCache() {
+    for (auto &shard : shards) {
+        lock_guard<mutex> cacheGuard(shard->cacheLock);
+        shard->queryCache.clear();
+    }
+}
+
+InventoryStatus ItemManager::applyUpdate(Shard &shard, const string &id, UpdateField field, double value) {
+    int index = shard.indexOfId(id);
+    if (index == -1)
+        return STATUS_NOT_FOUND;
+    if (!(value >= 0) || isinf(value))
+        return STATUS_INVALID_VALUE;  // Also rejects NaN
+    if (field == UPDATE_QUANTITY && (value != floor(value) || value > INT32_MAX))
+        return STATUS_INVALID_VALUE;  // Quantities are whole and fit the int32 column
+    if (field == UPDATE_QUANTITY && value < shard.reservations[index]->units)
+        return STATUS_INVALID_VALUE;  // Would sell off stock held by open checkouts
+
+    // Install a new version rather than modifying one a snapshot may hold
+    auto version = newVersion(*shard.rows[index].item);
+    if (field == UPDATE_QUANTITY)
+        version->setQuantity(static_cast<int>(value));
+    else
+        version->setPrice(value);
+    if (!persist(*version))
+        return STATUS_STORAGE_ERROR;
+    metrics.addAllocated(METRIC_UPDATE, itemBytes(*version));
+    if (field == UPDATE_QUANTITY)
+        shard.history.record(shard.historySlots[index], historyTime(), version->getQuantity());
+    shard.rows.mutableRow(index).item = move(version);
+    if (field == UPDATE_QUANTITY)
+        syncColumns(shard, index);
+    return STATUS_OK;
+}
+
+bool ItemManager::takeReserved(Reservation &reservation, int units) {
+    int current = reservation.units.load();
+    do {
+        if (current < units)
+            return false;
+    } while (!reservation.units.compare_exchange_weak(current, current - units));
+    return true;
+}
+
+SharedSelection ItemManager::selectRows(Shard &shard, ListFilter filter, uint8_t code) {
+    if (filter == LIST_ALL)
+        return nullptr;
+    if (filter == LIST_LOW_STOCK) {
+        // Assuming low stock is less than 5
+        return cachedSelection(shard, "LOWSTOCK", shard.quantityGeneration, [&](uint64_t *bitmap) {
+            pool.parallelFor(0, shard.rows.size(), SCAN_GRAIN, [&](int begin, int end) {
+                scanAtMost(shard.quantities.data() + begin, end - begin, 5, bitmap + begin / 64);
+            });
+        });
+    }
+    if (code == NO_CATEGORY) {
+        static const SharedSelection none = make_shared<const Selection>();
+        return none;
+    }
+    return cachedSelection(shard, "CATEGORY:" + to_string(code), shard.categoryGenerations[code],
+                           [&](uint64_t *bitmap) {
+        pool.parallelFor(0, shard.rows.size(), SCAN_GRAIN, [&](int begin, int end) {
+            scanEquals(shard.categoryCodes.data() + begin, end - begin, code, bitmap + begin / 64);
+        });
+    });
+}
+
+void ItemManager::syncColumns(Shard &shard, int index) {
+    shard.quantities[index] = shard.rows[index].item->getQuantity();
+    shard.categoryCodes[index] = categoryCode(shard.rows[index].item->getCategory());
+}
+
+void ItemManager::applyUpdates(Shard &shard) {
+    vector<UpdateCommand> batch;
+    vector<InventoryStatus> results;
+    UpdateCommand command;
+    while (true) {
+        while (batch.size() < UPDATE_BATCH_SIZE && shard.updates.tryPop(command))
+            batch.push_back(move(command));
+
+        if (batch.empty()) {
+            if (stopping)
+                return;
+            uint32_t seen = shard.wakeups.load(memory_order_acquire);
+            shard.writerSleeping.store(true, memory_order_relaxed);
+            atomic_thread_fence(memory_order_seq_cst);
+            if (!stopping && !shard.updates.hasPending())
+                shard.wakeups.wait(seen, memory_order_acquire);
+            shard.writerSleeping.store(false, memory_order_relaxed);
+            continue;
+        }
+
+        results.assign(batch.size(), STATUS_OK);
+        {
+            TRACE_SPAN("updateBatch");
+            unique_lock<shared_mutex> lock(shard.rwLock);
+            bool quantityChanged = false, priceChanged = false;
+            for (size_t i = 0; i < batch.size(); ++i) {
+                OperationTimer timer(metrics, METRIC_UPDATE);
+                results[i] = applyUpdate(shard, batch[i].id, batch[i].field, batch[i].value);
+                if (!timer.done(results[i] == STATUS_OK))
+                    continue;
+                if (batch[i].field == UPDATE_QUANTITY)
+                    quantityChanged = true;
+                else
+                    priceChanged = true;
+            }
+            shard.quantityGeneration += quantityChanged;
+            shard.priceGeneration += priceChanged;
+        }
+
+        // Complete the futures after releasing the lock
+        for (size_t i = 0; i < batch.size(); ++i)
+            batch[i].done.set_value(results[i]);
+        batch.clear();
+    }
+}
+
+void ItemManager::wakeWriter(Shard &shard) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (shard.writerSleeping.load(memory_order_relaxed)) {
+        shard.wakeups.fetch_add(1, memory_order_release);
+        shard.wakeups.notify_one();
+    }
+}
+
+void appendItem(string &reply, const Item &item) {
+    ostringstream line;
+    line << "ITEM " << item.getId() << ' ' << item.getQuantity() << ' ' << item.getPrice() << ' '
+         << item.getCategory() << ' ' << item.getName() << '\n';
+    reply += line.str();
+}
+
+// Whether a request changes the inventory. Successful mutations are what a
+// primary ships to its followers, and what a read-only follower refuses.
+bool isMutation(const string &request) {
+    static const string mutations[] = {"ADD", "SETQTY", "SETPRICE", "REMOVE", "SORT",
+                                       "DELTAS", "RESERVE", "COMMIT", "RELEASE", "DEFINE"};
+    istringstream in(request);
+    string command;
+    in >> command;
+    for (const string &mutation : mutations) {
+        if (equalsIgnoreCase(command, mutation))
+            return true;
+    }
+    return false;
+}
+
+// Request fields must be whole tokens: "2.7" is not a quantity of 2 and
+// "12abc" is not 12. Integers must also lie in [low, high].
+static bool parseInteger(const string &token, long long low, long long high, long long &value) {
+    char *end = nullptr;
+    value = strtoll(token.c_str(), &end, 10);
+    return end != token.c_str() && *end == '\0' && value >= low && value <= high;
+}
+
+static bool parseReal(const string &token, double &value) {
+    char *end = nullptr;
+    value = strtod(token.c_str(), &end);
+    return end != token.c_str() && *end == '\0';
+}
+
+// Runs one request and appends its reply; returns false when the client quits
+bool handleRequest(ItemManager &manager, const string &request, string &reply) {
+    const int MAX_PAGE = 1000;
+    TRACE_SPAN("handleRequest");
+
+    istringstream in(request);
+    string command, id;
+    if (!(in >> command))
+        return true;
+    command = toUpperCase(command);
+
+    if (command == "ADD") {
+        string category, quantityToken, priceToken, name;
+        long long quantity;
+        double price;
+        if (!(in >> id >> category >> quantityToken >> priceToken && getline(in >> ws, name)) ||
+            !parseInteger(quantityToken, INT32_MIN, INT32_MAX, quantity) || !parseReal(priceToken, price)) {
+            reply += "ERR invalid item\n";
+        } else {
+            InventoryStatus status = manager.add(id, name, static_cast<int>(quantity), price, category);
+            reply += status == STATUS_OK ? "OK\n" : string("ERR ") + statusMessage(status) + "\n";
+        }
+    } else if (command == "SETQTY" || command == "SETPRICE") {
+        string token;
+        UpdateField field = (command == "SETQTY") ? UPDATE_QUANTITY : UPDATE_PRICE;
+        long long quantity = -1;
+        double value = -1;
+        bool parsed = in >> id >> token && (field == UPDATE_QUANTITY ? parseInteger(token, 0, INT32_MAX, quantity)
+                                                                     : parseReal(token, value));
+        if (field == UPDATE_QUANTITY)
+            value = static_cast<double>(quantity);
+        if (!parsed || value < 0)
+            reply += "ERR invalid value\n";
+        else if (InventoryStatus status = manager.update(id, field, value); status != STATUS_OK)
+            reply += string("ERR ") + statusMessage(status) + "\n";
+        else
+            reply += "OK\n";
+    } else if (command == "DELTAS") {
+        vector<pair<string, int>> deltas;
+        string token;
+        bool valid = true;
+        {
+            TRACE_SPAN("parseDeltas");
+            while (valid && in >> token) {
+                size_t colon = token.rfind(':');
+                char *end = nullptr;
+                long change = colon == string::npos ? 0 : strtol(token.c_str() + colon + 1, &end, 10);
+                valid = colon != string::npos && colon > 0 && end && *end == '\0' &&
+                        end != token.c_str() + colon + 1 && change >= INT32_MIN && change <= INT32_MAX;
+                deltas.emplace_back(token.substr(0, colon), static_cast<int>(change));
+            }
+        }
+        if (!valid || deltas.empty())
+            reply += "ERR invalid deltas\n";
+        else if (InventoryStatus status = manager.applyQuantityDeltas(deltas, &id); status != STATUS_OK)
+            reply += string("ERR ") + statusMessage(status) + " " + id + "\n";
+        else
+            reply += "OK\n";
+    } else if (command == "RESERVE" || command == "COMMIT" || command == "RELEASE") {
+        string token;
+        long long units;
+        if (!(in >> id >> token) || !parseInteger(token, 1, INT32_MAX, units))
+            reply += "ERR invalid units\n";
+        else if (InventoryStatus status = command == "RESERVE" ? manager.reserve(id, static_cast<int>(units))
+                                          : command == "COMMIT"  ? manager.commit(id, static_cast<int>(units))
+                                                                 : manager.release(id, static_cast<int>(units));
+                 status != STATUS_OK)
+            reply += string("ERR ") + statusMessage(status) + "\n";
+        else
+            reply += "OK\n";
+    } else if (command == "DEFINE") {
+        string category;
+        InventoryStatus status = in >> category ? manager.defineCategory(category) : STATUS_INVALID_VALUE;
+        reply += status == STATUS_OK ? "OK\n" : string("ERR ") + statusMessage(status) + "\n";
+    } else if (command == "REMOVE") {
+        InventoryStatus status = in >> id ? manager.remove(id) : STATUS_NOT_FOUND;
+        reply += status == STATUS_OK ? "OK\n" : string("ERR ") + statusMessage(status) + "\n";
+    } else if (command == "GET" || command == "FIND") {
+        string name;
+        ItemView view;
+        if (command == "GET" && in >> id)
+            manager.find(id, view);
+        else if (command == "FIND" && getline(in >> ws, name))
+            manager.findByName(name, view);
+        if (view)
+            appendItem(reply, *view);
+        else
+            reply += "ERR not found\n";
+    } else if (command == "SORT") {
+        vector<SortKey> keys;
+        string key;
+        while (in >> key) {
+            if (key.size() != 2 || key[0] < '1' || key[0] > '5' || (upperAscii(key[1]) != 'A' && upperAscii(key[1]) != 'D')) {
+                keys.clear();
+                break;
+            }
+            keys.push_back({static_cast<SortField>(key[0] - '0'), upperAscii(key[1]) == 'A'});
+        }
+        if (keys.empty()) {
+            reply += "ERR invalid sort keys\n";
+        } else {
+            manager.sortBy(keys);
+            reply += "OK\n";
+        }
+    } else if (command == "LIST" || command == "LOWSTOCK" || command == "CATEGORY") {
+        ListQuery query{command == "LIST" ? LIST_ALL : command == "LOWSTOCK" ? LIST_LOW_STOCK : LIST_CATEGORY, ""};
+        if (query.filter == LIST_CATEGORY && !(in >> query.category)) {
+            reply += "ERR missing category\n";
+            return true;
+        }
+        if (query.filter == LIST_CATEGORY && !manager.isValidCategory(query.category)) {
+            reply += string("ERR ") + statusMessage(STATUS_UNKNOWN_CATEGORY) + "\n";
+            return true;
+        }
+        long long cursor = 0;
+        int limit = MAX_PAGE;
+        in >> cursor >> limit;
+        vector<ItemView> page;
+        int64_t next = manager.listItems(query, cursor, min(max(limit, 1), MAX_PAGE), page);
+        TRACE_SPAN("formatListing");
+        for (const ItemView &row : page)
+            appendItem(reply, *row);
+        reply += next == -1 ? "END -\n" : "END " + to_string(next) + "\n";
+    } else if (command == "VELOCITY") {
+        double days = 7, unitsPerDay = 0;
+        if (!(in >> id)) {
+            reply += "ERR not found\n";
+        } else {
+            if (!(in >> days))
+                days = 7;
+            InventoryStatus status = manager.salesVelocity(id, days, unitsPerDay);
+            ostringstream line;
+            line << fixed << setprecision(2) << unitsPerDay;
+            reply += status == STATUS_OK ? "VELOCITY " + line.str() + "\n" : string("ERR ") + statusMessage(status) + "\n";
+        }
+    } else if (command == "TOPMOVERS") {
+        int count = 10;
+        in >> count;
+        vector<pair<ItemView, double>> movers;
+        manager.topMovers(min(max(count, 1), MAX_PAGE), movers);
+        ostringstream lines;
+        lines << fixed << setprecision(2);
+        for (const auto &[item, rate] : movers)
+            lines << "MOVER " << item->getId() << ' ' << rate << '\n';
+        reply += lines.str() + "END\n";
+    } else if (command == "STATS") {
+        ostringstream text;
+        manager.statistics().writePrometheus(text);
+        reply += text.str() + "END\n";
+    } else if (command == "MEMORY") {
+        ostringstream text;
+        manager.writeMemoryReport(text);
+        reply += text.str() + "END\n";
+    } else if (command == "TRACE") {
+        reply += writeTrace() ? "OK\n" : "ERR tracing unavailable\n";
+    } else if (command == "QUIT") {
+        reply += "BYE\n";
+        return false;
+    } else {
+        reply += "ERR unknown command\n";
+    }
+    return true;
+}
@@ -0,0 +1,1195 @@
+#ifndef INVENTORY_H
+#define INVENTORY_H
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <thread>
+#include <future>
+#include <condition_variable>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <deque>
+#include <functional>
+#include <array>
+#include <cmath>
+#include <string_view>
+#include <variant>
+#include <iterator>
+#include <tuple>
+#include <utility>
+
+#include "history.h"
+#include "memory_tracker.h"
+#include "metrics.h"
+#include "storage.h"
+#include "trace.h"
+
+using namespace std;
+
+// Function to check if input is a valid numeric string (including decimals)
+inline bool isValidNumericString(const string &input) {
+    bool decimal = false;
+
+    for (char ch : input) {
+        if (ch == '.') {
+            if (decimal)  // Only allow one decimal point
+                return false;
+            decimal = true;
+        } else if (!isdigit(ch))  // Check if each character is a digit
+            return false;
+    }
+    return !input.empty();  // Return false if the string is empty
+}
+
+// ASCII-only upper-casing; avoids the locale lookup behind toupper(). Bytes of
+// multi-byte UTF-8 sequences have the high bit set and are left untouched.
+constexpr char upperAscii(char c) {
+    return (c >= 'a' && c <= 'z') ? static_cast<char>(c - ('a' - 'A')) : c;
+}
+
+// Upper-cases the ASCII letters of eight bytes at once (SWAR)
+inline uint64_t upperAscii8(uint64_t word) {
+    const uint64_t ones = 0x0101010101010101ULL;
+    uint64_t low7 = word & (ones * 0x7F);
+    uint64_t atLeastA = low7 + ones * (0x80 - 'a');
+    uint64_t aboveZ = low7 + ones * (0x80 - 'z' - 1);
+    uint64_t lowercase = atLeastA & ~aboveZ & ~word & (ones * 0x80);
+    return word ^ (lowercase >> 2);
+}
+
+inline string toUpperCase(const string &str) {
+    string upper(str);
+    size_t i = 0;
+    for (; i + 8 <= upper.size(); i += 8) {
+        uint64_t word;
+        memcpy(&word, &upper[i], 8);
+        word = upperAscii8(word);
+        memcpy(&upper[i], &word, 8);
+    }
+    for (; i < upper.size(); ++i)
+        upper[i] = upperAscii(upper[i]);
+    return upper;
+}
+
+// Case-insensitive equality that never allocates; non-ASCII bytes must match exactly
+inline bool equalsIgnoreCase(string_view a, string_view b) {
+    if (a.size() != b.size())
+        return false;
+
+    size_t i = 0;
+    for (; i + 8 <= a.size(); i += 8) {
+        uint64_t wordA, wordB;
+        memcpy(&wordA, &a[i], 8);
+        memcpy(&wordB, &b[i], 8);
+        if (wordA != wordB && upperAscii8(wordA) != upperAscii8(wordB))
+            return false;
+    }
+    for (; i < a.size(); ++i) {
+        if (upperAscii(a[i]) != upperAscii(b[i]))
+            return false;
+    }
+    return true;
+}
+
+// Case-insensitive FNV-1a, usable at compile time
+constexpr uint32_t categoryHash(string_view text, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ seed;
+    for (char c : text)
+        hash = (hash ^ static_cast<uint8_t>(upperAscii(c))) * 16777619u;
+    return hash;
+}
+
+// Built-in categories, indexed by code
+constexpr string_view BUILTIN_CATEGORIES[] = {"CLOTHING", "ELECTRONICS", "ENTERTAINMENT"};
+
+// Perfect hash for the built-ins: the first seed that gives each its own slot
+// in a table of BUILTIN_CATEGORY_SLOTS, found while compiling
+constexpr size_t BUILTIN_CATEGORY_SLOTS = 8;
+
+constexpr uint32_t findBuiltinCategorySeed() {
+    for (uint32_t seed = 0;; ++seed) {
+        bool taken[BUILTIN_CATEGORY_SLOTS] = {};
+        bool perfect = true;
+        for (string_view name : BUILTIN_CATEGORIES) {
+            size_t slot = categoryHash(name, seed) % BUILTIN_CATEGORY_SLOTS;
+            perfect = perfect && !taken[slot];
+            taken[slot] = true;
+        }
+        if (perfect)
+            return seed;
+    }
+}
+
+constexpr uint32_t BUILTIN_CATEGORY_SEED = findBuiltinCategorySeed();
+
+// Slot -> built-in code, 0xFF for empty slots
+constexpr array<uint8_t, BUILTIN_CATEGORY_SLOTS> buildBuiltinCategoryTable() {
+    array<uint8_t, BUILTIN_CATEGORY_SLOTS> table{};
+    table.fill(0xFF);
+    for (uint8_t code = 0; code < size(BUILTIN_CATEGORIES); ++code)
+        table[categoryHash(BUILTIN_CATEGORIES[code], BUILTIN_CATEGORY_SEED) % BUILTIN_CATEGORY_SLOTS] = code;
+    return table;
+}
+
+constexpr array<uint8_t, BUILTIN_CATEGORY_SLOTS> BUILTIN_CATEGORY_TABLE = buildBuiltinCategoryTable();
+
+// Interns category names as one-byte codes. The built-in categories take
+// codes 0-2 and are matched through a perfect hash table generated at compile
+// time; categories defined at runtime go in an open-addressing table that
+// never resizes, so lookups are lock-free and neither kind allocates.
+class CategoryDictionary {
+public:
+    static constexpr uint8_t UNKNOWN = 0xFF;
+    static const int CAPACITY = 255;  // Codes 0-254
+    static const size_t MAX_NAME_LENGTH = 32;
+
+    static const int BUILTIN_COUNT = static_cast<int>(std::size(BUILTIN_CATEGORIES));
+
+    CategoryDictionary() : count(BUILTIN_COUNT) {
+        for (auto &slot : slots)
+            slot.store(UNKNOWN, memory_order_relaxed);
+        for (uint8_t code = 0; code < BUILTIN_COUNT; ++code)
+            names[code] = BUILTIN_CATEGORIES[code];
+    }
+
+    // Returns the code of a category, matched case-insensitively, or UNKNOWN
+    uint8_t find(string_view name) const {
+        uint8_t code = BUILTIN_CATEGORY_TABLE[categoryHash(name, BUILTIN_CATEGORY_SEED) % BUILTIN_CATEGORY_SLOTS];
+        if (code != 0xFF && equalsIgnoreCase(name, BUILTIN_CATEGORIES[code]))
+            return code;
+        if (count.load(memory_order_acquire) == BUILTIN_COUNT)
+            return UNKNOWN;
+        for (size_t slot = categoryHash(name, 0) % SLOTS;; slot = (slot + 1) % SLOTS) {
+            code = slots[slot].load(memory_order_acquire);
+            if (code == UNKNOWN || equalsIgnoreCase(name, names[code]))
+                return code;
+        }
+    }
+
+    // Returns the code of a category, defining it if new. Returns UNKNOWN when
+    // the name is empty, too long or has whitespace, or every code is taken.
+    uint8_t define(string_view name) {
+        uint8_t code = find(name);
+        if (code != UNKNOWN || name.empty() || name.size() > MAX_NAME_LENGTH)
+            return code;
+        for (char c : name) {
+            if (!isgraph(static_cast<unsigned char>(c)))
+                return UNKNOWN;
+        }
+
+        lock_guard<mutex> guard(defineLock);
+        size_t slot = categoryHash(name, 0) % SLOTS;
+        for (; (code = slots[slot].load(memory_order_relaxed)) != UNKNOWN; slot = (slot + 1) % SLOTS) {
+            if (equalsIgnoreCase(name, names[code]))
+                return code;  // Defined by another thread meanwhile
+        }
+        code = static_cast<uint8_t>(count.load(memory_order_relaxed));
+        if (code == CAPACITY)
+            return UNKNOWN;
+        names[code].resize(name.size());
+        transform(name.begin(), name.end(), names[code].begin(), upperAscii);
+        // Publish the name before the slot and count that make it reachable
+        slots[slot].store(code, memory_order_release);
+        count.store(code + 1, memory_order_release);
+        return code;
+    }
+
+    // The name as stored on items, upper-cased
+    const string &name(uint8_t code) const {
+        return names[code];
+    }
+
+    int size() const {
+        return count.load(memory_order_acquire);
+    }
+
+private:
+    // Runtime categories; at most half full, so probes stay short and end
+    static const size_t SLOTS = 512;
+    atomic<uint8_t> slots[SLOTS];
+    string names[CAPACITY];  // Written once, before the code is published
+    atomic<int> count;
+    mutex defineLock;        // Serializes definitions; lookups never take it
+};
+
+// Selection bitmap produced by the scan kernels: bit i is set when row i matches
+using Selection = vector<uint64_t, TrackingAllocator<uint64_t, MEMORY_QUERY_CACHE>>;
+
+// A cached selection is never modified once built; readers hold it while a
+// concurrent reader may swap in a rescan. Null stands for every row.
+using SharedSelection = shared_ptr<const Selection>;
+
+// Bounded lock-free multi-producer/single-consumer ring buffer. Every slot
+// carries a sequence number telling producers and the consumer whose turn it
+// is, so producers only contend on one compare-and-swap of the tail. Empty
+// slots hold no T, so a queue of commands that allocate (e.g. promises)
+// allocates nothing until commands arrive.
+template <typename T>
+class CommandQueue {
+private:
+    struct Slot {
+        atomic<size_t> sequence;
+        optional<T> value;
+    };
+
+    size_t mask;
+    unique_ptr<Slot[]> slots;
+    alignas(64) atomic<size_t> tail;  // Next position producers claim
+    alignas(64) size_t head;          // Next position the consumer reads
+
+public:
+    // Capacity must be a power of two
+    explicit CommandQueue(size_t capacity) : mask(capacity - 1), slots(new Slot[capacity]), tail(0), head(0) {
+        for (size_t i = 0; i < capacity; ++i)
+            slots[i].sequence.store(i, memory_order_relaxed);
+    }
+
+    // Returns false without consuming the value if the queue is full
+    bool tryPush(T &&value) {
+        size_t position = tail.load(memory_order_relaxed);
+        while (true) {
+            Slot &slot = slots[position & mask];
+            size_t sequence = slot.sequence.load(memory_order_acquire);
+            if (sequence == position) {
+                if (tail.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+                    slot.value.emplace(move(value));
+                    slot.sequence.store(position + 1, memory_order_release);
+                    return true;
+                }
+            } else if (sequence < position) {
+                return false;
+            } else {
+                position = tail.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    // Only ever called from the single consumer thread
+    bool tryPop(T &value) {
+        Slot &slot = slots[head & mask];
+        if (slot.sequence.load(memory_order_acquire) != head + 1)
+            return false;
+        value = move(*slot.value);
+        slot.value.reset();
+        slot.sequence.store(head + mask + 1, memory_order_release);
+        head++;
+        return true;
+    }
+
+    bool hasPending() const {
+        return slots[head & mask].sequence.load(memory_order_acquire) == head + 1;
+    }
+};
+
+// Work-stealing thread pool for bulk operations. Each worker owns a deque and
+// takes tasks from its back; an idle worker steals from the front of the
+// others'. A thread waiting in parallelFor() steals too instead of blocking.
+class WorkStealingPool {
+private:
+    struct Worker {
+        mutex lock;
+        deque<function<void()>> tasks;
+    };
+
+    vector<unique_ptr<Worker>> workers;
+    vector<thread> threads;
+    atomic<int> queued;  // Tasks sitting in any deque
+    atomic<bool> stopping;
+    mutex sleepLock;
+    condition_variable wake;
+
+    void push(size_t worker, function<void()> task) {
+        {
+            lock_guard<mutex> guard(workers[worker]->lock);
+            workers[worker]->tasks.push_back(move(task));
+        }
+        queued++;
+        lock_guard<mutex> guard(sleepLock);  // Pairs with the sleeper's predicate check
+        wake.notify_one();
+    }
+
+    // Pops from the own deque's back first, then steals from the others' fronts
+    bool take(size_t self, function<void()> &task) {
+        for (size_t i = 0; i < workers.size(); ++i) {
+            Worker &victim = *workers[(self + i) % workers.size()];
+            lock_guard<mutex> guard(victim.lock);
+            if (victim.tasks.empty())
+                continue;
+            if (i == 0) {
+                task = move(victim.tasks.back());
+                victim.tasks.pop_back();
+            } else {
+                task = move(victim.tasks.front());
+                victim.tasks.pop_front();
+            }
+            queued--;
+            return true;
+        }
+        return false;
+    }
+
+    void work(size_t self) {
+        function<void()> task;
+        while (true) {
+            if (take(self, task)) {
+                task();
+                continue;
+            }
+            unique_lock<mutex> idle(sleepLock);
+            wake.wait(idle, [this] { return stopping || queued > 0; });
+            if (stopping && queued == 0)
+                return;
+        }
+    }
+
+public:
+    explicit WorkStealingPool(unsigned threadCount) : queued(0), stopping(false) {
+        for (unsigned i = 0; i < threadCount; ++i)
+            workers.push_back(make_unique<Worker>());
+        for (unsigned i = 0; i < threadCount; ++i)
+            threads.emplace_back(&WorkStealingPool::work, this, i);
+    }
+
+    ~WorkStealingPool() {
+        {
+            lock_guard<mutex> guard(sleepLock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (thread &worker : threads)
+            worker.join();
+    }
+
+    // Pool shared by all bulk operations; the calling thread makes up the last core
+    static WorkStealingPool &shared() {
+        static WorkStealingPool pool(max(thread::hardware_concurrency(), 1u) - 1);
+        return pool;
+    }
+
+    // Runs body(begin, end) over [first, last) in chunks of grain items spread
+    // across the workers, and returns once every chunk is done. Ranges of a
+    // single chunk run inline.
+    template <typename Body>
+    void parallelFor(int first, int last, int grain, Body body) {
+        int chunks = (last - first + grain - 1) / grain;
+        if (chunks <= 1 || workers.empty()) {
+            if (first < last)
+                body(first, last);
+            return;
+        }
+
+        atomic<int> remaining(chunks);
+        for (int chunk = 0; chunk < chunks; ++chunk) {
+            int begin = first + chunk * grain;
+            int end = min(last, begin + grain);
+            push(chunk % workers.size(), [&body, &remaining, begin, end] {
+                body(begin, end);
+                remaining--;
+            });
+        }
+
+        function<void()> task;
+        size_t start = 0;
+        while (remaining > 0) {
+            if (take(start++ % workers.size(), task))
+                task();
+            else
+                this_thread::yield();
+        }
+    }
+};
+
+class Item {
+private:
+    string id, name;
+    int quantity;
+    uint32_t stringBytes;  // Heap bytes of the strings, charged to MEMORY_STRINGS
+    double price;
+    string category;
+
+    static size_t heapBytes(const string &text) {
+        static const size_t inlineCapacity = string().capacity();
+        return text.capacity() > inlineCapacity ? text.capacity() + 1 : 0;
+    }
+
+    // The strings never change after construction, so their heap size is
+    // charged once here and refunded by the destructor
+    void chargeStrings() {
+        stringBytes = static_cast<uint32_t>(heapBytes(id) + heapBytes(name) + heapBytes(category));
+        if (stringBytes)
+            MemoryTracker::allocated(MEMORY_STRINGS, stringBytes);
+    }
+
+    void refundStrings() {
+        if (stringBytes)
+            MemoryTracker::released(MEMORY_STRINGS, stringBytes);
+        stringBytes = 0;
+    }
+
+public:
+    Item(string id, string name, int quantity, double price, string category)
+            : id(move(id)), name(move(name)), quantity(quantity), price(price), category(move(category)) {
+        chargeStrings();
+    }
+
+    Item(const Item &other)
+            : id(other.id), name(other.name), quantity(other.quantity), price(other.price), category(other.category) {
+        chargeStrings();
+    }
+
+    // A move takes over the buffers and the charge for them
+    Item(Item &&other) noexcept
+            : id(move(other.id)), name(move(other.name)), quantity(other.quantity), stringBytes(other.stringBytes),
+              price(other.price), category(move(other.category)) {
+        other.stringBytes = 0;
+    }
+
+    Item &operator=(const Item &other) {
+        if (this != &other) {
+            Item copy(other);
+            *this = move(copy);
+        }
+        return *this;
+    }
+
+    Item &operator=(Item &&other) noexcept {
+        if (this != &other) {
+            refundStrings();
+            id = move(other.id);
+            name = move(other.name);
+            quantity = other.quantity;
+            price = other.price;
+            category = move(other.category);
+            stringBytes = other.stringBytes;
+            other.stringBytes = 0;
+        }
+        return *this;
+    }
+
+    ~Item() { refundStrings(); }
+
+    // Bytes of string data actually in use on the heap
+    size_t getStringPayload() const {
+        size_t payload = 0;
+        for (const string *text : {&id, &name, &category}) {
+            if (heapBytes(*text))
+                payload += text->size() + 1;
+        }
+        return payload;
+    }
+
+    const string &getId() const { return id; }
+    const string &getName() const { return name; }
+    int getQuantity() const { return quantity; }
+    double getPrice() const { return price; }
+    const string &getCategory() const { return category; }
+
+    void setQuantity(int newQuantity) { quantity = newQuantity; }
+    void setPrice(double newPrice) { price = newPrice; }
+};
+
+// Units of an item held by open checkouts. Changed with atomic compare-and-swap
+// so concurrent checkouts of one item never wait for each other; padded to a
+// cache line so hot items do not share one.
+struct alignas(64) Reservation {
+    atomic<int> units{0};
+
+    // Charged to MEMORY_COLUMNS alongside the columns
+    static void *operator new(size_t size, align_val_t alignment) {
+        void *memory = ::operator new(size, alignment);
+        MemoryTracker::allocated(MEMORY_COLUMNS, size);
+        return memory;
+    }
+
+    static void operator delete(void *memory, size_t size, align_val_t alignment) noexcept {
+        MemoryTracker::released(MEMORY_COLUMNS, size);
+        ::operator delete(memory, alignment);
+    }
+};
+
+// Fields that sortBy() can order by, numbered as in the menu's sort prompt
+enum SortField { SORT_QUANTITY = 1, SORT_PRICE, SORT_NAME, SORT_ID, SORT_CATEGORY };
+
+struct SortKey {
+    SortField field;
+    bool ascending;
+};
+
+// Read-only view of one item version. Versions are immutable, so a view stays
+// valid and unchanged however the inventory changes afterwards.
+using ItemView = shared_ptr<const Item>;
+
+// The rows of one ItemManager shard, each item's current version and rank, in
+// fixed-size chunks reached through a directory. A copy shares the directory
+// and the chunks, so pinning a table costs one reference count whatever its
+// size. While a copy is alive, a change copies the directory first, and
+// each chunk it writes to that an older directory still shares; once every
+// copy is gone, changes are made in place again. Liveness is counted with
+// release decrements and acquire loads rather than read off use_count(),
+// so the last reader's accesses happen before the writer's.
+//
+// Not synchronized: ItemManager copies and reads a shard's table under the
+// shard's shared lock and changes it under the exclusive lock. A copy, once
+// taken, may be read without any lock.
+class RowTable {
+public:
+    struct Row {
+        ItemView item;
+        uint64_t rank = 0;  // Place in the global listing order; ascending within a table
+    };
+
+    RowTable() = default;
+
+    RowTable(const RowTable &other) : directory(other.directory), count(other.count), pinning(directory != nullptr) {
+        if (pinning)
+            directory->pins.fetch_add(1, memory_order_relaxed);
+    }
+
+    RowTable(RowTable &&other) noexcept
+        : directory(move(other.directory)), count(exchange(other.count, 0)), pinning(exchange(other.pinning, false)) {}
+
+    RowTable &operator=(const RowTable &other) {
+        return *this = RowTable(other);
+    }
+
+    RowTable &operator=(RowTable &&other) noexcept {
+        if (this != &other) {
+            unpin();
+            directory = move(other.directory);
+            count = exchange(other.count, 0);
+            pinning = exchange(other.pinning, false);
+        }
+        return *this;
+    }
+
+    ~RowTable() { unpin(); }
+
+    int size() const { return count; }
+
+    const Row &operator[](int index) const {
+        return directory->chunks[index / CHUNK_ROWS]->rows[index % CHUNK_ROWS];
+    }
+
+    // A row to change in place, unshared from pinned copies first
+    Row &mutableRow(int index) {
+        return ownChunk(index / CHUNK_ROWS).rows[index % CHUNK_ROWS];
+    }
+
+    void push_back(Row row) {
+        if (count % CHUNK_ROWS == 0) {
+            Directory &own = ownDirectory();
+            own.chunks.push_back(allocate_shared<Chunk>(TrackingAllocator<Chunk, MEMORY_ITEMS>()));
+        }
+        mutableRow(count++) = move(row);
+    }
+
+    // Removes a row, shifting the later ones down
+    void erase(int index) {
+        int last = count - 1;
+        for (int chunk = index / CHUNK_ROWS; chunk <= last / CHUNK_ROWS; ++chunk)
+            ownChunk(chunk);
+        for (int i = index; i < last; ++i)
+            slot(i) = move(slot(i + 1));
+        slot(last) = Row();
+        if (--count % CHUNK_ROWS == 0)
+            directory->chunks.pop_back();
+    }
+
+    // Index of the first row ranked at or after rank
+    int lowerBound(uint64_t rank) const {
+        int low = 0, high = count;
+        while (low < high) {
+            int middle = low + (high - low) / 2;
+            if ((*this)[middle].rank < rank)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        return low;
+    }
+
+private:
+    static const int CHUNK_ROWS = 1024;
+
+    struct Chunk {
+        Row rows[CHUNK_ROWS];
+        atomic<int> sharers{0};  // Retired directories still pointing here
+
+        Chunk() = default;
+        Chunk(const Chunk &other) { copy(begin(other.rows), end(other.rows), rows); }
+    };
+
+    struct Directory {
+        vector<shared_ptr<Chunk>, TrackingAllocator<shared_ptr<Chunk>, MEMORY_ITEMS>> chunks;
+        atomic<int> pins{0};   // Live copies of the table reading through this directory
+        bool retired = false;  // Replaced by a newer directory sharing its chunks
+
+        ~Directory() {
+            if (retired) {
+                for (auto &chunk : chunks)
+                    chunk->sharers.fetch_sub(1, memory_order_release);
+            }
+        }
+    };
+
+    shared_ptr<Directory> directory;
+    int count = 0;
+    bool pinning = false;  // This is a copy, counted in directory->pins
+
+    Row &slot(int index) { return directory->chunks[index / CHUNK_ROWS]->rows[index % CHUNK_ROWS]; }
+
+    void unpin() {
+        if (pinning && directory)
+            directory->pins.fetch_sub(1, memory_order_release);
+        pinning = false;
+    }
+
+    Directory &ownDirectory() {
+        if (!directory || directory->pins.load(memory_order_acquire) > 0) {
+            auto fresh = allocate_shared<Directory>(TrackingAllocator<Directory, MEMORY_ITEMS>());
+            if (directory) {
+                fresh->chunks = directory->chunks;
+                for (auto &chunk : fresh->chunks)
+                    chunk->sharers.fetch_add(1, memory_order_relaxed);
+                directory->retired = true;
+            }
+            unpin();
+            directory = move(fresh);
+        }
+        return *directory;
+    }
+
+    Chunk &ownChunk(int chunk) {
+        Directory &own = ownDirectory();
+        if (own.chunks[chunk]->sharers.load(memory_order_acquire) > 0)
+            own.chunks[chunk] = allocate_shared<Chunk>(TrackingAllocator<Chunk, MEMORY_ITEMS>(), *own.chunks[chunk]);
+        return *own.chunks[chunk];
+    }
+};
+
+// Walks the selected rows of several row tables in rank order, keeping each
+// table's next selected row in a min-heap. A null selection selects every
+// row; rows past the end of a bitmap were appended after the scan and are not
+// selected.
+class RowMerge {
+public:
+    struct Source {
+        const RowTable *rows;
+        const Selection *matches;
+    };
+
+    RowMerge() = default;  // Already done
+    RowMerge(vector<Source> sources, uint64_t from);
+
+    bool done() const { return heads.empty(); }
+    int source() const { return heads.front().second; }
+    int index() const { return positions[source()]; }
+    const RowTable::Row &row() const { return (*sources[source()].rows)[index()]; }
+    void next();
+
+    // Index of the first selected row at or after the cursor, skipping
+    // unselected rows a bitmap word at a time
+    static int nextMatch(const RowTable &rows, int cursor, const Selection *matches);
+
+    static size_t countMatches(const RowTable &rows, const Selection *matches);
+
+private:
+    using Head = pair<uint64_t, int>;  // (rank, source)
+    vector<Source> sources;
+    vector<int> positions;
+    vector<Head> heads;
+
+    void advance(int source, int cursor);
+};
+
+// Consistent view of the rows a query selected: every shard's row table as it
+// was, with the query's selection over it. Taking one costs a few reference
+// counts per shard whatever the row count; the shards are merged into listing
+// order lazily, as the snapshot is iterated, with no lock held. The item
+// versions it saw stay valid and unchanged while writers install newer ones.
+class Snapshot {
+public:
+    // Merges a batch of rows ahead, so the caller's loads of the items they
+    // point to overlap as they would walking a vector
+    class iterator {
+    public:
+        using iterator_category = forward_iterator_tag;
+        using value_type = ItemView;
+        using difference_type = ptrdiff_t;
+        using pointer = const ItemView *;
+        using reference = const ItemView &;
+
+        iterator() = default;
+
+        reference operator*() const { return *batch[used]; }
+        pointer operator->() const { return batch[used]; }
+
+        iterator &operator++() {
+            if (++used == filled)
+                refill();
+            return *this;
+        }
+
+        iterator operator++(int) {
+            iterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        bool operator==(const iterator &other) const {
+            if (filled == 0 || other.filled == 0)
+                return filled == other.filled;
+            return batch[used] == other.batch[other.used];
+        }
+
+    private:
+        friend class Snapshot;
+        static const int BATCH_ROWS = 64;
+
+        explicit iterator(RowMerge merge) : merge(move(merge)) { refill(); }
+
+        void refill() {
+            used = filled = 0;
+            for (; filled < BATCH_ROWS && !merge.done(); merge.next())
+                batch[filled++] = &merge.row().item;
+        }
+
+        RowMerge merge;
+        const ItemView *batch[BATCH_ROWS];
+        int used = 0, filled = 0;  // filled is 0 once the rows run out
+    };
+
+    iterator begin() const;
+    iterator end() const { return iterator(); }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+private:
+    friend class ItemManager;
+    vector<RowTable> tables;              // Indexed like the shards
+    vector<SharedSelection> selections;   // Null selects every row
+    size_t count = 0;
+};
+
+// Which rows a listing returns
+enum ListFilter { LIST_ALL, LIST_CATEGORY, LIST_LOW_STOCK };
+
+struct ListQuery {
+    ListFilter filter;
+    string category;  // Only used by LIST_CATEGORY
+};
+
+// A quantity or price change queued for the writer thread of its shard
+enum UpdateField { UPDATE_QUANTITY = 1, UPDATE_PRICE };
+
+// Outcome of an ItemManager operation
+enum InventoryStatus {
+    STATUS_OK,
+    STATUS_NOT_FOUND,
+    STATUS_DUPLICATE_ID,
+    STATUS_UNKNOWN_CATEGORY,
+    STATUS_INVALID_VALUE,      // Negative, or a quantity below the units reserved
+    STATUS_OVER_MEMORY_BUDGET,
+    STATUS_CATEGORY_LIMIT,     // Every category code is taken
+    STATUS_STORAGE_ERROR,      // The storage backend could not be read or written
+    STATUS_INSUFFICIENT_STOCK, // Fewer units on hand than a sale or reservation needs
+    STATUS_NOT_RESERVED        // Fewer units reserved than a release or commit gives back
+};
+
+struct UpdateCommand {
+    UpdateField field;
+    string id;
+    double value;
+    promise<InventoryStatus> done;  // Fulfilled with the outcome of applying it
+};
+
+const char *statusMessage(InventoryStatus status);
+
+// The inventory engine. Every public method is safe to call from any thread
+// and does no console I/O; the interactive menu (menu.h) and the server are
+// clients of this API like any other.
+//
+// Items are partitioned into shards by a hash of their ID, one per core by
+// default. A shard owns its rows, lock, cached listings, history and writer
+// thread, so operations on items in different shards never contend.
+// Listings, sorts and other whole-inventory operations lock every shard in
+// shard order, run per shard in parallel, and merge the results. Rows carry
+// a rank giving their place in the one global order listings follow:
+// insertion order, or the order of the last sortBy().
+class ItemManager {
+public:
+    // shardCount 0 gives one shard per hardware thread. Bulk work (scans,
+    // sorts, per-shard steps) runs on pool.
+    explicit ItemManager(int shardCount = 0, WorkStealingPool &pool = WorkStealingPool::shared());
+
+    ~ItemManager();
+
+    // Switches to a persistent storage backend (a file for STORAGE_MAPPED, a
+    // directory for STORAGE_LSM) and loads the items it holds. Call once at
+    // startup, before anything else uses the inventory.
+    InventoryStatus openStorage(StorageKind kind, const string &path);
+
+    // Adds an item. Fails with STATUS_INVALID_VALUE on a negative quantity or
+    // price, and with STATUS_OVER_MEMORY_BUDGET when the budget is used up even
+    // after dropping cached listings.
+    InventoryStatus add(const string &id, const string &name, int quantity, double price, const string &category);
+
+    // Looks an item up by ID, or by case-insensitive name (a linear scan that
+    // returns the first match in listing order)
+    InventoryStatus find(const string &id, ItemView &view) const;
+    InventoryStatus findByName(const string &name, ItemView &view) const;
+
+    // Sets an item's quantity or price right away, bypassing the writer thread.
+    // Fails with STATUS_INVALID_VALUE on a negative value, or a quantity that
+    // is fractional, above INT32_MAX or below the units reserved.
+    InventoryStatus update(const string &id, UpdateField field, double value);
+
+    // Removes an item, optionally handing back its last version
+    InventoryStatus remove(const string &id, ItemView *removed = nullptr);
+
+    // Replaces rows with a snapshot of the rows the query selects. The locks
+    // are only held to pin each shard's rows and selection, not to copy the
+    // rows; they are then read without them.
+    InventoryStatus query(const ListQuery &query, Snapshot &rows);
+
+    // Appends up to limit rows of a listing, starting at the cursor, to page.
+    // Returns the cursor of the next page, or -1 once the listing is exhausted.
+    // Cursors are row ranks, so rows removed between pages do not shift later
+    // ones; a sortBy() in between starts the order over.
+    int64_t listItems(const ListQuery &query, int64_t cursor, int limit, vector<ItemView> &page);
+
+    // Queues a quantity or price change for the writer thread of the item's
+    // shard. Any number of threads may submit concurrently; the future reports
+    // the outcome as update() would.
+    future<InventoryStatus> submitUpdate(const string &id, UpdateField field, double value);
+
+    // Applies a batch of (id, quantity change) pairs atomically: either every
+    // delta applies or none does. Deltas for the same ID are combined, only
+    // the shards holding the items are locked, items are touched in storage
+    // order, and cached listings are invalidated once for the batch. On
+    // failure, failedId (if given) names the offending item:
+    // STATUS_NOT_FOUND for an unknown ID, STATUS_INSUFFICIENT_STOCK when a
+    // quantity would drop below zero or below the units reserved, and
+    // STATUS_INVALID_VALUE when it would exceed INT32_MAX.
+    InventoryStatus applyQuantityDeltas(const vector<pair<string, int>> &deltas, string *failedId = nullptr);
+
+    // Holds units of an item for a checkout. Runs under the shard's shared
+    // lock, so checkouts of the same item only contend on one
+    // compare-and-swap, and fails with STATUS_INSUFFICIENT_STOCK rather than
+    // reserving more than is on hand.
+    InventoryStatus reserve(const string &id, int units);
+
+    // Gives reserved units back, e.g. for an abandoned checkout
+    InventoryStatus release(const string &id, int units);
+
+    // Completes a checkout: the reserved units leave the on-hand quantity
+    InventoryStatus commit(const string &id, int units);
+
+    int reservedUnits(const string &id) const;
+
+    // An item's recent quantity changes, oldest first. Every change is kept
+    // until its ring fills; the first entry is the oldest point still held.
+    InventoryStatus quantityHistory(const string &id, vector<QuantityChange> &changes) const;
+
+    // Units sold (quantity decreases, including checkouts) per day over the
+    // last windowDays, decoded from the item's history
+    InventoryStatus salesVelocity(const string &id, double windowDays, double &unitsPerDay) const;
+
+    // The count items selling fastest, fastest first, with their recent sales
+    // rate in units per day. Items with no recent sales are left out.
+    void topMovers(int count, vector<pair<ItemView, double>> &movers) const;
+
+    // Reorders the items by the given keys, most significant first
+    void sortBy(const vector<SortKey> &keys);
+
+    bool isEmpty() const;
+
+    // Validates category in a case-insensitive manner
+    bool isValidCategory(const string &category) const;
+
+    // Returns the code stored in the category column, or NO_CATEGORY if unknown
+    uint8_t categoryCode(const string &category) const;
+
+    // Adds a category besides the built-in ones; defining an existing one is
+    // a no-op. Names are up to 32 characters without whitespace.
+    InventoryStatus defineCategory(const string &category);
+
+    // Categories are numbered 0 to categoryCount() - 1, built-ins first
+    int categoryCount() const;
+    const string &categoryName(uint8_t code) const;
+
+    // Per-operation counters and latency histograms
+    const Metrics &statistics() const {
+        return metrics;
+    }
+
+    // Heap usage per component. Fragmentation is the share of a component's
+    // bytes not holding live data: spare vector capacity, hash buckets,
+    // padding, shared_ptr control blocks, and item versions or copies that
+    // snapshots and callers still hold.
+    void writeMemoryReport(ostream &out);
+
+    static const uint8_t NO_CATEGORY = CategoryDictionary::UNKNOWN;
+
+private:
+    static constexpr int MAX_SHARDS = 64;
+    static const size_t UPDATE_QUEUE_SIZE = 1024;
+    static const size_t UPDATE_BATCH_SIZE = 256;
+
+    // A query result remembers the generations it was computed at. Generations
+    // start at 1, so a freshly inserted entry never looks current.
+    struct CachedQuery {
+        uint64_t layoutGeneration = 0;
+        uint64_t columnGeneration = 0;
+        SharedSelection matches;
+    };
+    using QueryCache = unordered_map<string, CachedQuery, hash<string>, equal_to<string>,
+                                     TrackingAllocator<pair<const string, CachedQuery>, MEMORY_QUERY_CACHE>>;
+
+    // One shard: the rows whose IDs hash to it, in rank order, and the state
+    // that goes with them. Every structure allocates through TrackingAllocator
+    // so the memory report can break usage down by component.
+    struct Shard {
+        // Each row holds the current version of an item and its place in the
+        // global order. Versions are immutable: writers install a modified
+        // copy, and readers holding the old version, or a Snapshot of the
+        // table, keep it alive until they let go.
+        RowTable rows;
+
+        // Columns mirrored from items so filters scan contiguous memory
+        vector<int32_t, TrackingAllocator<int32_t, MEMORY_COLUMNS>> quantities;
+        vector<uint8_t, TrackingAllocator<uint8_t, MEMORY_COLUMNS>> categoryCodes;
+
+        // Reserved units per item, never more than its quantity
+        vector<unique_ptr<Reservation>, TrackingAllocator<unique_ptr<Reservation>, MEMORY_COLUMNS>> reservations;
+
+        // Quantity changes per item; historySlots moves with the rows like
+        // reservations
+        QuantityHistory history;
+        vector<uint32_t, TrackingAllocator<uint32_t, MEMORY_COLUMNS>> historySlots;
+
+        // Maps each ID to its position in items for constant-time lookups
+        unordered_map<string, int, hash<string>, equal_to<string>,
+                      TrackingAllocator<pair<const string, int>, MEMORY_ID_INDEX>> idIndex;
+
+        // Readers (lookups, listings) share the lock; writers (add, update,
+        // remove, sort) hold it exclusively. Everything above is only touched
+        // under it.
+        mutable shared_mutex rwLock;
+
+        // Bumped whenever rows move (remove, reorder) or a column's values
+        // change; appending a row only bumps the columns it adds a value to
+        uint64_t layoutGeneration = 1;
+        uint64_t quantityGeneration = 1;
+        uint64_t priceGeneration = 1;
+        uint64_t categoryGenerations[CategoryDictionary::CAPACITY];
+
+        QueryCache queryCache;  // Keyed by normalized query
+        mutex cacheLock;        // Readers sharing rwLock may fill the cache concurrently
+
+        // Updates queued by submitUpdate() for this shard's writer thread. The
+        // writer sleeps on wakeups while the queue is empty. It sets
+        // writerSleeping before its last look at the queue, and producers
+        // check it after pushing, with a fence on each side, so either the
+        // writer sees the command or the producer sees the writer asleep and
+        // bumps wakeups.
+        CommandQueue<UpdateCommand> updates;
+        atomic<bool> writerSleeping;
+        atomic<uint32_t> wakeups;
+        thread writer;
+
+        Shard() : updates(UPDATE_QUEUE_SIZE), writerSleeping(false), wakeups(0) {
+            fill(begin(categoryGenerations), end(categoryGenerations), 1);
+        }
+
+        int indexOfId(const string &id) const {
+            auto found = idIndex.find(id);
+            return found == idIndex.end() ? -1 : found->second;
+        }
+    };
+
+    WorkStealingPool &pool;
+    vector<unique_ptr<Shard>> shards;
+
+    // Rank of the next row added. Taken while holding the new row's shard
+    // lock, so every shard's ranks ascend and a reader holding all shard
+    // locks never sees a row without every earlier-ranked one.
+    atomic<uint64_t> nextRank;
+
+    // The shard an ID hashes to
+    size_t shardIndex(const string &id) const;
+    Shard &shardOf(const string &id) const;
+
+    // Lock every shard, always in shard order, so operations spanning
+    // several shards cannot deadlock
+    vector<shared_lock<shared_mutex>> lockShared() const;
+    vector<unique_lock<shared_mutex>> lockExclusive();
+
+    // Runs body(shard, shard number) for every shard, in parallel on the pool
+    template <typename Body>
+    void forEachShard(Body body) const;
+
+    // Calls visit(shard number, index) for the rows matching each shard's
+    // selection, in rank order starting at rank from, until visit returns
+    // false. The caller holds every shard lock; selections are indexed like
+    // shards.
+    template <typename Visit>
+    void mergeRows(const vector<SharedSelection> &selections, uint64_t from, Visit visit) const;
+
+    // Builds or fetches every shard's selection for a listing, in parallel.
+    // The caller holds every shard lock.
+    vector<SharedSelection> selectAll(ListFilter filter, uint8_t code);
+
+    // Every row in global order, gathered from the shards for sortBy()
+    struct SortRows {
+        vector<const Item *> items;
+        vector<uint8_t> codes;
+    };
+
+    // Returns the stable permutation of rows ordered by the given keys. Keys
+    // are applied least significant first (LSD), each pass being stable, so
+    // earlier keys win and ties keep their previous order.
+    vector<int> sortedOrder(const SortRows &rows, const vector<SortKey> &keys);
+
+    // Sort passes are instantiated per field and order, so key extraction and
+    // comparisons compile to straight-line code with no per-element branches.
+    // sortedOrder() picks one from SORT_PASSES once per key.
+    using SortPass = void (ItemManager::*)(const SortRows &rows, vector<int> &order);
+    static const SortPass SORT_PASSES[SORT_CATEGORY][2];  // [field - 1][ascending]
+
+    // Maps quantity or price onto an unsigned key whose byte order matches numeric order
+    template <SortField Field>
+    static uint64_t normalizedKey(const Item *item);
+
+    // Stable LSD radix sort of the permutation on a numeric key, one byte per pass
+    template <SortField Field, bool Ascending>
+    void radixSortByNumber(const SortRows &rows, vector<int> &order);
+
+    // Stable MSD radix sort of the permutation on the ID, or case-insensitively on the name
+    template <SortField Field, bool Ascending>
+    void sortByText(const SortRows &rows, vector<int> &order);
+
+    // Stable counting sort of the permutation on the category column
+    template <bool Ascending>
+    void sortByCategory(const SortRows &rows, vector<int> &order);
+
+    // Rows per task when bulk work is split across the thread pool; smaller
+    // inventories are handled inline. Scan chunks stay a multiple of 64 so
+    // each task fills whole bitmap words.
+    static const int PARALLEL_GRAIN = 1 << 14;
+    static const int SCAN_GRAIN = 1 << 16;
+
+    // Unlocked scan for use while the shard's lock is held
+    int indexOfName(const Shard &shard, const string &name) const;
+
+    mutable Metrics metrics;  // Updated by readers too, so const methods may record
+
+    // New item versions share one allocation with their reference count
+    template <typename... Args>
+    static shared_ptr<Item> newVersion(Args &&...args) {
+        return allocate_shared<Item>(TrackingAllocator<Item, MEMORY_ITEMS>(), forward<Args>(args)...);
+    }
+
+    // Approximate heap footprint of an item version: the object plus any string
+    // too long for the small-string buffer
+    static uint64_t itemBytes(const Item &item);
+
+    // sortBy() results, checked against the sums of every shard's
+    // generations; only changed with every shard locked exclusively
+    QueryCache sortCache;
+
+    CategoryDictionary categories;
+
+    // Returns the cached selection for a query, rescanning only when the rows
+    // or the column it filters on have changed since it was computed
+    template <typename Scan>
+    SharedSelection cachedSelection(Shard &shard, const string &queryKey, uint64_t columnGeneration, Scan scan);
+
+    void spillQueryCache();
+
+    // Sets a quantity or price while the shard's lock is held exclusively;
+    // the caller bumps the generation counters
+    InventoryStatus applyUpdate(Shard &shard, const string &id, UpdateField field, double value);
+
+    static bool takeReserved(Reservation &reservation, int units);
+
+    // Builds or fetches the selection bitmap for a listing while the shard's
+    // lock is held; LIST_ALL needs none and gets null
+    SharedSelection selectRows(Shard &shard, ListFilter filter, uint8_t code);
+
+    // Copies an item's scanned fields into the column arrays
+    void syncColumns(Shard &shard, int index);
+
+    // Chosen at startup. Mutations write through to it while holding their
+    // shards' locks exclusively, and fail without changing anything if that
+    // write fails. Shards write concurrently, so a persistent backend is only
+    // used under storageLock.
+    variant<MemoryStorage, MappedStorage, LogStructuredStorage> storage;
+    mutex storageLock;
+
+    // Stages records with stage(backend) and writes them through as one batch
+    template <typename Stage>
+    bool writeThrough(Stage stage);
+
+    bool persist(const Item &item);
+    bool persistRemoval(const string &id);
+
+    // Appends a new item version to its shard with the next rank, updating the
+    // columns, index and generations
+    void appendVersion(Shard &shard, shared_ptr<const Item> version, uint8_t code);
+
+    // History timestamps: seconds since the Unix epoch
+    static uint32_t historyTime();
+
+    atomic<bool> stopping;
+
+    // Writer thread of a shard: drains its queued updates and applies each
+    // batch under a single write lock, bumping the generation counters once
+    // per batch
+    void applyUpdates(Shard &shard);
+
+    // Called by producers after pushing; wakes the shard's writer if it is asleep
+    static void wakeWriter(Shard &shard);
+};
+
+// Line protocol spoken in server mode. Every request is one line and gets one
+// reply line, except listings, which reply with ITEM lines followed by
+// "END <next cursor>" ("END -" when exhausted). Blank lines are ignored.
+//   ADD <id> <category> <quantity> <price> <name...>
+//   SETQTY <id> <quantity>      SETPRICE <id> <price>      REMOVE <id>
+//   GET <id>                    FIND <name...>             SORT <field><A|D>...
+//   LIST [cursor [limit]]       LOWSTOCK [cursor [limit]]  CATEGORY <category> [cursor [limit]]
+//   DELTAS <id>:<change>...     (applied atomically, e.g. "DELTAS A1:-2 B7:5")
+//                               (a rejected batch replies "ERR <reason> <id>")
+//   RESERVE <id> <units>        COMMIT <id> <units>        RELEASE <id> <units>
+//   DEFINE <category>           (adds a category besides the built-in ones)
+//   VELOCITY <id> [days]        (units sold per day, over 7 days by default)
+//   TOPMOVERS [count]           (MOVER <id> <units/day> lines, then "END")
+//   STATS                       (Prometheus text metrics, then "END")
+//   TRACE                       (writes the trace file, when built with tracing)
+//   MEMORY                      (heap usage per component, then "END")
+//   PROMOTE                     (on a follower: stop following, accept writes)
+//   QUIT
+// SORT fields are numbered as in the menu, e.g. "SORT 5A 2D 3A".
+void appendItem(string &reply, const Item &item);
+
+// Whether a request changes the inventory. Successful mutations are what a
+// primary ships to its followers, and what a read-only follower refuses.
+bool isMutation(const string &request);
+
+// Runs one request and appends its reply; returns false when the client quits
+bool handleRequest(ItemManager &manager, const string &request, string &reply);
+
+#endif  // INVENTORY_H
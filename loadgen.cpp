@@ -0,0 +1,279 @@
+#include "inventory.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+
+// Load generator for capacity testing.
+//
+// Usage: midterm_project_oop_loadgen [--items N] [--ops N] [--threads N] [--rate OPS_PER_SEC]
+//                                    [--mix LOOKUP,UPDATE,ADD,REMOVE] [--zipf S] [--replay FILE]
+//
+// Drives the engine in-process through handleRequest, the same path the
+// server uses, so generated traffic and replayed logs exercise identical code.
+// The default mix is 80% lookups, 15% quantity updates, 4% adds and 1%
+// removes, with SKU popularity following a Zipf distribution (exponent 0.99).
+// --replay sends the protocol lines of a recorded log (e.g. a replication
+// log) in order from a single client instead.
+//
+// Without --rate each client issues its next request as soon as the last one
+// completes. With --rate requests are scheduled open loop at that aggregate
+// rate and latency is measured from the scheduled time, so a stalled engine
+// shows up as queueing delay rather than as a lower offered load.
+
+enum OperationType { OP_LOOKUP, OP_UPDATE, OP_ADD, OP_REMOVE, OP_REPLAY, OP_TYPE_COUNT };
+
+static const char *OPERATION_NAMES[] = {"lookup", "update", "add", "remove", "replay"};
+static const char *CATEGORIES[] = {"Clothing", "Electronics", "Entertainment"};
+
+struct LoadOptions {
+    int items = 100000;
+    long long ops = 1000000;
+    int threads = 1;
+    double rate = 0;  // 0 runs closed loop
+    int mix[4] = {80, 15, 4, 1};
+    double zipfExponent = 0.99;
+    string replayPath;
+};
+
+// Samples item ranks with probability proportional to 1 / rank^exponent
+class ZipfGenerator {
+public:
+    ZipfGenerator(int count, double exponent) : cumulative(count) {
+        double sum = 0;
+        for (int rank = 0; rank < count; ++rank) {
+            sum += 1.0 / pow(rank + 1, exponent);
+            cumulative[rank] = sum;
+        }
+        for (double &value : cumulative)
+            value /= sum;
+    }
+
+    int next(mt19937_64 &random) const {
+        double point = uniform_real_distribution<double>(0, 1)(random);
+        return static_cast<int>(lower_bound(cumulative.begin(), cumulative.end(), point) - cumulative.begin());
+    }
+
+private:
+    vector<double> cumulative;
+};
+
+struct ClientResult {
+    vector<uint64_t> latencies[OP_TYPE_COUNT];  // Nanoseconds
+    long long errors = 0;
+};
+
+// Builds the next generated request for one client
+class WorkloadClient {
+public:
+    WorkloadClient(const LoadOptions &options, const ZipfGenerator &zipf, const vector<int> &popularity, int client)
+        : options(options), zipf(zipf), popularity(popularity), client(client), random(client + 1) {}
+
+    OperationType next(string &request) {
+        int roll = static_cast<int>(random() % 100);
+        int type = 0;
+        while (type < 3 && roll >= options.mix[type]) {
+            roll -= options.mix[type];
+            ++type;
+        }
+        // Removes only take back this client's own adds, so the popular SKUs stay resolvable
+        if (type == OP_REMOVE && added.empty())
+            type = OP_ADD;
+
+        string id = "SKU" + to_string(popularity[zipf.next(random)]);
+        switch (type) {
+        case OP_LOOKUP:
+            request = "GET " + id;
+            break;
+        case OP_UPDATE:
+            request = "SETQTY " + id + " " + to_string(random() % 100);
+            break;
+        case OP_ADD: {
+            string newId = "LOAD" + to_string(client) + "-" + to_string(nextAdded++);
+            request = "ADD " + newId + " " + CATEGORIES[random() % 3] + " " + to_string(random() % 100) +
+                      " 9.99 Load item " + newId;
+            added.push_back(move(newId));
+            break;
+        }
+        default:
+            request = "REMOVE " + added.back();
+            added.pop_back();
+            break;
+        }
+        return static_cast<OperationType>(type);
+    }
+
+private:
+    const LoadOptions &options;
+    const ZipfGenerator &zipf;
+    const vector<int> &popularity;
+    int client;
+    mt19937_64 random;
+    long long nextAdded = 0;
+    vector<string> added;
+};
+
+// Sends requests from source until it returns false, pacing them when a rate is set
+template <typename Source>
+void runClient(ItemManager &manager, double rate, Source source, ClientResult &result) {
+    using Clock = chrono::steady_clock;
+    const auto SPIN_WINDOW = chrono::microseconds(200);
+    auto interval = rate > 0 ? chrono::duration_cast<Clock::duration>(chrono::duration<double>(1.0 / rate))
+                             : Clock::duration::zero();
+    auto scheduled = Clock::now();
+    string request, reply;
+    OperationType type;
+    while (source(request, type)) {
+        if (rate > 0) {
+            // Sleeps can overshoot by tens of microseconds, so the last stretch is spun
+            this_thread::sleep_until(scheduled - SPIN_WINDOW);
+            while (Clock::now() < scheduled)
+                this_thread::yield();
+        } else {
+            scheduled = Clock::now();
+        }
+        reply.clear();
+        handleRequest(manager, request, reply);
+        auto finished = Clock::now();
+        result.latencies[type].push_back(chrono::duration_cast<chrono::nanoseconds>(finished - scheduled).count());
+        if (reply.compare(0, 3, "ERR") == 0)
+            ++result.errors;
+        scheduled += interval;
+    }
+}
+
+double percentile(const vector<uint64_t> &sorted, double fraction) {
+    if (sorted.empty())
+        return 0;
+    size_t index = min(sorted.size() - 1, static_cast<size_t>(fraction * sorted.size()));
+    return sorted[index] / 1000.0;
+}
+
+void printLatencies(const string &label, vector<uint64_t> &latencies) {
+    sort(latencies.begin(), latencies.end());
+    cout << left << setw(10) << label << right << setw(12) << latencies.size() << fixed << setprecision(1)
+         << setw(12) << percentile(latencies, 0.50) << setw(12) << percentile(latencies, 0.99) << setw(12)
+         << percentile(latencies, 0.999) << setw(12) << percentile(latencies, 1.0) << endl;
+}
+
+bool parseOptions(int argc, char *argv[], LoadOptions &options) {
+    for (int i = 1; i < argc; ++i) {
+        string flag = argv[i];
+        if (i + 1 >= argc) {
+            cout << "Missing value for " << flag << endl;
+            return false;
+        }
+        string value = argv[++i];
+        if (flag == "--items") {
+            options.items = max(atoi(value.c_str()), 1);
+        } else if (flag == "--ops") {
+            options.ops = max(atoll(value.c_str()), 1LL);
+        } else if (flag == "--threads") {
+            options.threads = max(atoi(value.c_str()), 1);
+        } else if (flag == "--rate") {
+            options.rate = max(atof(value.c_str()), 0.0);
+        } else if (flag == "--zipf") {
+            options.zipfExponent = max(atof(value.c_str()), 0.0);
+        } else if (flag == "--replay") {
+            options.replayPath = value;
+        } else if (flag == "--mix") {
+            int total = 0, field = 0;
+            istringstream in(value);
+            string part;
+            while (field < 4 && getline(in, part, ','))
+                total += options.mix[field++] = max(atoi(part.c_str()), 0);
+            if (field != 4 || total != 100) {
+                cout << "--mix needs four percentages adding up to 100" << endl;
+                return false;
+            }
+        } else {
+            cout << "Unknown option " << flag << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    LoadOptions options;
+    if (!parseOptions(argc, argv, options))
+        return 1;
+
+    ItemManager manager;
+    vector<string> replay;
+    if (!options.replayPath.empty()) {
+        ifstream log(options.replayPath);
+        if (!log) {
+            cout << "Cannot open " << options.replayPath << endl;
+            return 1;
+        }
+        string line;
+        while (getline(log, line))
+            if (!line.empty())
+                replay.push_back(line);
+        options.threads = 1;  // A log only makes sense in its recorded order
+    } else {
+        for (int i = 0; i < options.items; ++i)
+            manager.add("SKU" + to_string(i), "Item " + to_string(i), 50, 9.99, CATEGORIES[i % 3]);
+    }
+
+    // Popularity rank -> item, shuffled so hot SKUs are spread over the table
+    vector<int> popularity(options.items);
+    for (int i = 0; i < options.items; ++i)
+        popularity[i] = i;
+    shuffle(popularity.begin(), popularity.end(), mt19937_64(7));
+    ZipfGenerator zipf(options.replayPath.empty() ? options.items : 1, options.zipfExponent);
+
+    vector<ClientResult> results(options.threads);
+    vector<thread> clients;
+    auto started = chrono::steady_clock::now();
+    for (int client = 0; client < options.threads; ++client) {
+        clients.emplace_back([&, client] {
+            double rate = options.rate / options.threads;
+            if (!replay.empty()) {
+                size_t next = 0;
+                runClient(manager, rate, [&](string &request, OperationType &type) {
+                    if (next == replay.size())
+                        return false;
+                    request = replay[next++];
+                    type = OP_REPLAY;
+                    return true;
+                }, results[client]);
+                return;
+            }
+            // Spreads the remainder over the first clients
+            long long quota = options.ops / options.threads + (client < options.ops % options.threads);
+            WorkloadClient workload(options, zipf, popularity, client);
+            runClient(manager, rate, [&](string &request, OperationType &type) {
+                if (quota-- == 0)
+                    return false;
+                type = workload.next(request);
+                return true;
+            }, results[client]);
+        });
+    }
+    for (thread &client : clients)
+        client.join();
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+    vector<uint64_t> all, byType[OP_TYPE_COUNT];
+    long long errors = 0;
+    for (ClientResult &result : results) {
+        for (int type = 0; type < OP_TYPE_COUNT; ++type) {
+            byType[type].insert(byType[type].end(), result.latencies[type].begin(), result.latencies[type].end());
+            all.insert(all.end(), result.latencies[type].begin(), result.latencies[type].end());
+        }
+        errors += result.errors;
+    }
+
+    cout << "Completed " << all.size() << " requests in " << fixed << setprecision(3) << elapsed << " s ("
+         << setprecision(0) << all.size() / elapsed << " ops/s, " << errors << " errors)" << endl;
+    cout << left << setw(10) << "Operation" << right << setw(12) << "Count" << setw(12) << "p50 us" << setw(12)
+         << "p99 us" << setw(12) << "p99.9 us" << setw(12) << "max us" << endl;
+    for (int type = 0; type < OP_TYPE_COUNT; ++type)
+        if (!byType[type].empty())
+            printLatencies(OPERATION_NAMES[type], byType[type]);
+    printLatencies("all", all);
+    return 0;
+}
@@ -1,381 +1,562 @@
-#include <iostream>
-#include <iomanip>
-#include <string>
-#include <cctype>
-
-
-using namespace std;
-
-// Function to check if input is a valid numeric string (including decimals)
-bool isValidNumericString(const string &input) {
-    bool decimal = false;
-
-    for (char ch : input) {
-        if (ch == '.') {
-            if (decimal)  // Only allow one decimal point
-                return false;
-            decimal = true;
-        } else if (!isdigit(ch))  // Check if each character is a digit
-            return false;
-    }
-    return !input.empty();  // Return false if the string is empty
-}
-
-string toUpperCase(string str) {
-    for (char &c : str) {
-        if (isalpha(c))
-            c = toupper(c);
-    }
-    return str;
-}
-
-class Item {
-private:
-    string id, name;
-    int quantity;
-    double price;
-    string category;
-
-public:
-    Item(string id, string name, int quantity, double price, string category)
-            : id(id), name(name), quantity(quantity), price(price), category(category) {}
-
-    string getId() const { return id; }
-    string getName() const { return name; }
-    int getQuantity() const { return quantity; }
-    double getPrice() const { return price; }
-    string getCategory() const { return category; }
-
-    void setQuantity(int newQuantity) { quantity = newQuantity; }
-    void setPrice(double newPrice) { price = newPrice; }
-
-    void display() const {
-        cout << left << setw(10) << id << setw(20) << name << setw(10) << quantity
-             << setw(10) << price << setw(15) << category << endl;
-    }
+#include "menu.h"
+
+#include <coroutine>
+#include <cstdio>
+#include <fstream>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#endif
+
+#ifdef __linux__
+// Fire-and-forget coroutine: starts running immediately and frees its frame
+// when it finishes
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() { return {}; }
+        suspend_never initial_suspend() noexcept { return {}; }
+        suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { terminate(); }
+    };
 };
 
-class Inventory {
-protected:
-    Item* items[100];  // Max 100 items in inventory
-    int itemCount;     // Initialize itemCount
-public:
-    Inventory() : itemCount(0) {}  // Constructor to initialize itemCount
-    virtual void displayAllItems() = 0;
-    virtual void addItem() = 0;
-    virtual void displayItemsByCategory() = 0;
-    virtual void searchItem() = 0;
-    virtual void sortItems() = 0;
-    virtual void displayLowStockItems() = 0;
-    virtual void updateItem() = 0;
-    virtual void removeItems() = 0;
+struct ServerOptions {
+    string address;             // Socket path or localhost port for clients
+    string replicationAddress;  // Primary: where followers connect, empty if none
+    string primaryAddress;      // Follower: the primary's replication address
 };
 
-class ItemManager : public Inventory {
-public:
-    // Validates category in a case-insensitive manner
-    bool isValidCategory(const string &category) {
-        string lowerCategory = toUpperCase(category);
-        return lowerCategory == "CLOTHING" || lowerCategory == "ELECTRONICS" || lowerCategory == "ENTERTAINMENT";
+// Serves the line protocol on a Unix domain socket, or on localhost TCP when the
+// address is a port number. Each client session is a coroutine that suspends
+// while its socket is not ready; one epoll loop resumes them, so a single
+// thread multiplexes every session. All complete lines in a read are answered
+// in order, so clients may pipeline requests.
+//
+// Replication ships the mutation log to read-only followers. A primary
+// started with a replication address sends each new follower the current
+// items as ADD/RESERVE lines, then every successful mutation request in the
+// order it was applied. A follower applies that stream and refuses mutations
+// from its own clients. It only starts accepting writes when a client sends
+// PROMOTE; losing the primary is not enough, since the primary may still be
+// serving writes the follower cannot see. Whoever promotes a follower must
+// first make sure the old primary is down. A follower whose copy stops
+// matching the primary (a replicated request that does not reply OK) stops
+// following and refuses promotion; it must be restarted with empty storage
+// to resync.
+class InventoryServer {
+private:
+    static const size_t MAX_LINE = 1 << 20;
+
+    // Awaitable that parks the calling coroutine until fd is ready for events
+    struct Ready {
+        InventoryServer &server;
+        int fd;
+        uint32_t events;
+
+        bool await_ready() const { return false; }
+        void await_suspend(coroutine_handle<> session) { server.park(fd, events, session); }
+        void await_resume() const {}
+    };
+
+    // Log lines not yet sent to a follower, and its feed coroutine when it is
+    // waiting for more of them
+    struct Follower {
+        string pending;
+        coroutine_handle<> idle;
+    };
+
+    // Awaitable that parks a follower's feed until new log lines arrive
+    struct LogAppended {
+        Follower &follower;
+
+        bool await_ready() const { return !follower.pending.empty(); }
+        void await_suspend(coroutine_handle<> feed) { follower.idle = feed; }
+        void await_resume() const {}
+    };
+
+    ItemManager &manager;
+    int epollFd;
+    int listenFd;
+    int replicationFd;
+    int primaryFd;   // Follower: connection to the primary, -1 once it is gone
+    bool readOnly;
+    bool diverged;   // Follower: a replicated request failed
+    unordered_map<int, coroutine_handle<>> parked;  // Suspended coroutines by socket
+    unordered_map<int, Follower> followers;
+    char buffer[65536];  // Shared by sessions, none suspends while using it
+
+    // Fills addr for a Unix socket path, or for localhost when given a port
+    static socklen_t resolve(const string &address, sockaddr_storage &storage) {
+        storage = sockaddr_storage{};
+        if (!address.empty() && isValidNumericString(address) && address.find('.') == string::npos) {
+            auto *addr = reinterpret_cast<sockaddr_in *>(&storage);
+            addr->sin_family = AF_INET;
+            addr->sin_port = htons(static_cast<uint16_t>(stoi(address)));
+            addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            return sizeof(sockaddr_in);
+        }
+        auto *addr = reinterpret_cast<sockaddr_un *>(&storage);
+        if (address.size() >= sizeof addr->sun_path)
+            return 0;
+        addr->sun_family = AF_UNIX;
+        strcpy(addr->sun_path, address.c_str());
+        return sizeof(sockaddr_un);
     }
 
-    int findItemById(const string &id) {
-        for (int i = 0; i < itemCount; ++i) {
-            if (items[i]->getId() == id)
-                return i;
+    static int listenOn(const string &address) {
+        sockaddr_storage storage;
+        socklen_t length = resolve(address, storage);
+        if (length == 0)
+            return -1;
+        int fd = socket(storage.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd == -1)
+            return -1;
+
+        if (storage.ss_family == AF_INET) {
+            int reuse = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof reuse);
+        } else {
+            unlink(address.c_str());  // Replace a stale socket from an earlier run
+        }
+        if (::bind(fd, reinterpret_cast<sockaddr *>(&storage), length) == -1 || listen(fd, SOMAXCONN) == -1) {
+            ::close(fd);
+            return -1;
         }
-        return -1;
+        return fd;
     }
 
-    int findItemByName(const string &name) {
-        string lowerName = toUpperCase(name);
-        for (int i = 0; i < itemCount; ++i) {
-            if (toUpperCase(items[i]->getName()) == lowerName)
-                return i;
+    static int connectTo(const string &address) {
+        sockaddr_storage storage;
+        socklen_t length = resolve(address, storage);
+        if (length == 0)
+            return -1;
+        int fd = socket(storage.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd == -1)
+            return -1;
+        if (connect(fd, reinterpret_cast<sockaddr *>(&storage), length) == -1 ||
+            fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
+            ::close(fd);
+            return -1;
         }
-        return -1;
+        return fd;
     }
 
-    void addItem() override {
-        string id, name, category, quantityStr, priceStr;
-        int quantity;
-        double price;
-        bool isDuplicate = true;
+    void park(int fd, uint32_t events, coroutine_handle<> coroutine) {
+        epoll_event event{};
+        event.events = events;
+        event.data.fd = fd;
+        if (epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event) == -1)
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+        parked[fd] = coroutine;
+    }
 
-        // Input and validate category (case-insensitive)
-        do {
-            cout << "Enter Category (Clothing, Electronics, Entertainment): ";
-            cin >> category;
+    void closeSocket(int fd) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        parked.erase(fd);
+        ::close(fd);
+    }
 
-            // Check if category is valid (case-insensitive check)
-            if (!isValidCategory(category)) {
-                cout << "Invalid category! Please enter 'Clothing', 'Electronics', or 'Entertainment'." << endl;
-            }
-        } while (!isValidCategory(category));
-
-        // Check for duplicate IDs
-        while (isDuplicate) {
-            cout << "Enter Item ID: ";
-            cin >> id;
-
-            isDuplicate = false;  // Assume it's not a duplicate initially
-            for (int i = 0; i < itemCount; i++) {  // Check all existing items
-                if (items[i]->getId() == id) {  // If the ID already exists
-                    isDuplicate = true;  // Mark as duplicate and prompt again
-                    cout << "ERROR: An item already has that ID, please enter another ID.\n";
-                    break;
-                }
-            }
+    // Reads whatever is available; returns false once the peer has gone
+    bool readInto(int fd, string &input) {
+        while (true) {
+            ssize_t count = read(fd, buffer, sizeof buffer);
+            if (count > 0)
+                input.append(buffer, count);
+            else if (count == 0 || (errno != EAGAIN && errno != EINTR))
+                return false;
+            else if (errno == EAGAIN)
+                return true;
         }
-
-        cout << "Enter Item Name: ";
-        cin.ignore();
-        getline(cin, name);
-
-        // Validate quantity input to ensure it's greater than 0
-        do {
-            cout << "Enter Quantity: ";
-            cin >> quantityStr;
-            if (!isValidNumericString(quantityStr) || stoi(quantityStr) <= 0) {
-                cout << "Input a valid quantity! Quantity must be greater than 0." << endl;
-            }
-        } while (!isValidNumericString(quantityStr) || stoi(quantityStr) <= 0);
-        quantity = stoi(quantityStr);
-
-        // Validate price input to ensure it's greater than 0
-        do {
-            cout << "Enter Price: ";
-            cin >> priceStr;
-            if (!isValidNumericString(priceStr) || stod(priceStr) <= 0) {
-                cout << "Input a valid price! Price must be greater than 0." << endl;
-            }
-        } while (!isValidNumericString(priceStr) || stod(priceStr) <= 0);
-        price = stod(priceStr);
-
-        // Add the item to the inventory
-        items[itemCount++] = new Item(id, name, quantity, price, toUpperCase(category));
-        cout << "Item added successfully!" << endl;
     }
 
-    void updateItem() override {
-        if (itemCount == 0) {
-            cout << "No items available to update!" << endl;
-            return;
+    // Runs one client request, refusing mutations on a follower and shipping
+    // successful ones to followers on a primary
+    bool execute(const string &request, string &output) {
+        if (isPromote(request)) {
+            promote(output);
+            return true;
         }
-
-        string id, newQuantityStr, newPriceStr;
-        cout << "Enter Item ID: ";
-        cin >> id;
-
-        int index = findItemById(id);
-        if (index == -1) {
-            cout << "Item not found!" << endl;
-            return;
+        if (readOnly && isMutation(request)) {
+            output += "ERR read-only replica\n";
+            return true;
         }
+        size_t replyStart = output.size();
+        bool keepOpen = handleRequest(manager, request, output);
+        if (!followers.empty() && isMutation(request) && output.compare(replyStart, 3, "OK\n") == 0)
+            shipToFollowers(request);
+        return keepOpen;
+    }
 
-        int choice;
-        cout << "Update (1- Quantity, 2- Price): ";
-        cin >> choice;
-
-        if (choice == 1) {
-            int newQuantity;
-            do {
-                cout << "Enter new Quantity: ";
-                cin >> newQuantityStr;
-                if (!isValidNumericString(newQuantityStr) || stoi(newQuantityStr) < 0) {
-                    cout << "Invalid quantity! Please enter a valid positive number." << endl;
-                }
-            } while (!isValidNumericString(newQuantityStr) || stoi(newQuantityStr) < 0);
-            newQuantity = stoi(newQuantityStr);
-            items[index]->setQuantity(newQuantity);
-            cout << "Quantity of Item " << items[index]->getName() << " is updated!" << endl;
-        } else if (choice == 2) {
-            double newPrice;
-            do {
-                cout << "Enter new Price: ";
-                cin >> newPriceStr;
-                if (!isValidNumericString(newPriceStr) || stod(newPriceStr) < 0) {
-                    cout << "Invalid price! Please enter a valid positive number." << endl;
-                }
-            } while (!isValidNumericString(newPriceStr) || stod(newPriceStr) < 0);
-            newPrice = stod(newPriceStr);
-            items[index]->setPrice(newPrice);
-            cout << "Price of Item " << items[index]->getName() << " is updated!" << endl;
-        } else {
-            cout << "Invalid option!" << endl;
-        }
+    static bool isPromote(const string &request) {
+        istringstream in(request);
+        string command;
+        return in >> command && equalsIgnoreCase(command, "PROMOTE");
     }
 
-    void removeItems() override {
-        if (itemCount == 0) {
-            cout << "There is nothing to remove!" << endl;
+    // Stops following the primary and starts accepting writes
+    void promote(string &output) {
+        if (!readOnly) {
+            output += "ERR not a follower\n";
             return;
         }
-        string id;
-        cout << "Enter Item ID: ";
-        cin >> id;
-        toUpperCase(id);
-
-        int index = findItemById(id);
-        if (index == -1) {
-            cout << "Item with ID " << id << " was not found." << endl;
+        if (diverged) {
+            output += "ERR replica diverged from the primary\n";
             return;
         }
-
-        cout << "Item " << items[index]->getName() << " has been removed from the inventory." << endl;
-
-        // Shift the remaining items to fill the gap
-        delete items[index];  // Free the memory
-        for (int i = index; i < itemCount - 1; ++i) {
-            items[i] = items[i + 1];
+        if (primaryFd != -1) {
+            // The follow coroutine only suspends parked on the primary's socket
+            coroutine_handle<> follow = parked[primaryFd];
+            closeSocket(primaryFd);
+            follow.destroy();
+            primaryFd = -1;
         }
-        itemCount--;  // Decrease item count
+        readOnly = false;
+        output += "OK\n";
+        cout << "Promoted; now accepting writes." << endl;
     }
 
-    void displayAllItems() override {
-        if (itemCount == 0) {
-            cout << "No items available!" << endl;
-            return;
+    void shipToFollowers(const string &line) {
+        vector<coroutine_handle<>> waiting;
+        for (auto &entry : followers) {
+            entry.second.pending += line;
+            entry.second.pending += '\n';
+            if (entry.second.idle) {
+                waiting.push_back(entry.second.idle);
+                entry.second.idle = nullptr;
+            }
         }
+        for (coroutine_handle<> feed : waiting)
+            feed.resume();
+    }
 
-        cout << left << setw(10) << "ID" << setw(20) << "Name" << setw(10) << "Quantity"
-             << setw(10) << "Price" << setw(15) << "Category" << endl;
-
-        for (int i = 0; i < itemCount; i++) {
-            items[i]->display();
+    // The current items, as the requests that would recreate them
+    string snapshotLog() {
+        ostringstream log;
+        log.precision(17);
+        for (int code = CategoryDictionary::BUILTIN_COUNT; code < manager.categoryCount(); ++code)
+            log << "DEFINE " << manager.categoryName(static_cast<uint8_t>(code)) << '\n';
+        Snapshot all;
+        manager.query({LIST_ALL, ""}, all);
+        for (const ItemView &item : all) {
+            log << "ADD " << item->getId() << ' ' << item->getCategory() << ' ' << item->getQuantity() << ' '
+                << item->getPrice() << ' ' << item->getName() << '\n';
+            int reserved = manager.reservedUnits(item->getId());
+            if (reserved > 0)
+                log << "RESERVE " << item->getId() << ' ' << reserved << '\n';
         }
+        return log.str();
     }
 
-    void displayItemsByCategory() override {
-        if (itemCount == 0) {
-            cout << "No items available!" << endl;
-            return;
+    Detached acceptClients() {
+        while (true) {
+            co_await Ready{*this, listenFd, EPOLLIN};
+            int fd;
+            while ((fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+                session(fd);
         }
+    }
 
-        string category;
-        cout << "Enter Category (Clothing, Electronics, Entertainment): ";
-        cin >> category;
-        category = toUpperCase(category);
-
-        cout << left << setw(10) << "ID" << setw(20) << "Name" << setw(10) << "Quantity"
-             << setw(10) << "Price" << setw(15) << "Category" << endl;
-
-        bool found = false;
-        for (int i = 0; i < itemCount; i++) {
-            if (items[i]->getCategory() == category) {
-                items[i]->display();
-                found = true;
+    Detached acceptFollowers() {
+        while (true) {
+            co_await Ready{*this, replicationFd, EPOLLIN};
+            int fd;
+            while ((fd = accept4(replicationFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+                followers[fd].pending = snapshotLog();
+                feedFollower(fd);
             }
         }
-        if (!found) {
-            cout << "No items found in the " << category << " category!" << endl;
-        }
     }
 
-    void searchItem() override {
-        if (itemCount == 0) {
-            cout << "No items available!" << endl;
-            return;
-        }
-
-        string name;
-        cout << "Enter Item Name: ";
-        cin.ignore();
-        getline(cin, name);
-
-        int index = findItemByName(name);
-        if (index != -1) {
-            cout << "Item found!" << endl;
-            items[index]->display();
-        } else {
-            cout << "Item not found!" << endl;
+    // One follower: send its pending log lines, then wait for more
+    Detached feedFollower(int fd) {
+        Follower &follower = followers[fd];  // Stays valid, map nodes do not move
+        while (true) {
+            size_t sent = 0;
+            while (sent < follower.pending.size()) {
+                ssize_t count = send(fd, follower.pending.data() + sent, follower.pending.size() - sent, MSG_NOSIGNAL);
+                if (count > 0) {
+                    sent += count;
+                } else if (errno == EAGAIN) {
+                    follower.pending.erase(0, sent);
+                    sent = 0;
+                    co_await Ready{*this, fd, EPOLLOUT};
+                } else if (errno != EINTR) {
+                    followers.erase(fd);
+                    closeSocket(fd);
+                    co_return;
+                }
+            }
+            follower.pending.clear();
+            co_await LogAppended{follower};
         }
     }
 
-    void sortItems() override
-    {
-        // Check if there are items to sort
-        if (itemCount == 0)
-        {
-            cout << "There is nothing to sort." << endl;
-            return;
+    // Follower side: apply the primary's log as it arrives. Every line must
+    // reply OK as it did on the primary; otherwise the copies have diverged
+    // and applying more would compound it.
+    Detached followPrimary() {
+        string input, reply;
+        bool connected = true;
+        while (connected) {
+            co_await Ready{*this, primaryFd, EPOLLIN};
+            connected = readInto(primaryFd, input);
+
+            size_t start = 0, end;
+            while ((end = input.find('\n', start)) != string::npos) {
+                string line = input.substr(start, end - start);
+                start = end + 1;
+                reply.clear();
+                handleRequest(manager, line, reply);
+                if (reply != "OK\n") {
+                    cout << "Replicated request \"" << line << "\" failed: " << reply;
+                    diverged = true;
+                    connected = false;
+                    break;
+                }
+            }
+            input.erase(0, start);
         }
 
-        string choice;
-        bool ascending;
-
-        // Prompt for sorting criteria
-        cout << "Sort by: 1. Quantity 2. Price: ";
-        cin >> choice;
-
-        // Ask for sort order
-        char orderChoice;
-        cout << "Sort in ascending order? (Y/N): ";
-        cin >> orderChoice;
-        ascending = (toupper(orderChoice) == 'Y');
+        closeSocket(primaryFd);
+        primaryFd = -1;
+        if (diverged)
+            cout << "Stopped following; restart with empty storage to resync." << endl;
+        else
+            cout << "Lost the primary; still read-only until a PROMOTE request." << endl;
+    }
 
-        // Bubble Sort
-        for (int i = 0; i < itemCount - 1; ++i)
-        {
-            for (int j = 0; j < itemCount - i - 1; ++j)
-            {
-                bool swapNeeded = false;
-
-                if (choice == "1") // Sort by Quantity
-                {
-                    if ((ascending && items[j]->getQuantity() > items[j + 1]->getQuantity()) ||
-                        (!ascending && items[j]->getQuantity() < items[j + 1]->getQuantity()))
-                    {
-                        swapNeeded = true;
-                    }
-                }
-                else if (choice == "2") // Sort by Price
-                {
-                    if ((ascending && items[j]->getPrice() > items[j + 1]->getPrice()) ||
-                        (!ascending && items[j]->getPrice() < items[j + 1]->getPrice()))
-                    {
-                        swapNeeded = true;
-                    }
+    // One client: read whatever arrived, answer every complete line, flush the
+    // replies, and suspend whenever the socket would block
+    Detached session(int fd) {
+        string input, output;
+        bool open = true;
+        while (open) {
+            co_await Ready{*this, fd, EPOLLIN};
+            open = readInto(fd, input);  // If the peer hung up, still answer what it sent
+
+            size_t start = 0, end;
+            while ((end = input.find('\n', start)) != string::npos) {
+                size_t length = end - start;
+                if (length > 0 && input[end - 1] == '\r')
+                    length--;
+                bool keepOpen = execute(input.substr(start, length), output);
+                start = end + 1;
+                if (!keepOpen) {
+                    open = false;
+                    break;
                 }
-
-                if (swapNeeded)
-                {
-                    // Hardcode the swap logic
-                    Item *temp = items[j];
-                    items[j] = items[j + 1];
-                    items[j + 1] = temp;
+            }
+            input.erase(0, start);
+            if (input.size() > MAX_LINE)
+                open = false;
+
+            size_t sent = 0;
+            while (sent < output.size()) {
+                ssize_t count = send(fd, output.data() + sent, output.size() - sent, MSG_NOSIGNAL);
+                if (count > 0) {
+                    sent += count;
+                } else if (errno == EAGAIN) {
+                    co_await Ready{*this, fd, EPOLLOUT};
+                } else if (errno != EINTR) {
+                    open = false;
+                    break;
                 }
             }
+            output.clear();
         }
+
+        closeSocket(fd);
     }
 
+public:
+    explicit InventoryServer(ItemManager &manager)
+            : manager(manager), epollFd(-1), listenFd(-1), replicationFd(-1), primaryFd(-1), readOnly(false),
+              diverged(false) {}
+
+    ~InventoryServer() {
+        for (auto &waiting : parked) {
+            if (waiting.first != listenFd && waiting.first != replicationFd)
+                ::close(waiting.first);
+            waiting.second.destroy();
+        }
+        for (auto &follower : followers) {
+            if (follower.second.idle) {
+                ::close(follower.first);
+                follower.second.idle.destroy();
+            }
+        }
+        if (listenFd != -1)
+            ::close(listenFd);
+        if (replicationFd != -1)
+            ::close(replicationFd);
+        if (epollFd != -1)
+            ::close(epollFd);
+    }
 
-    void displayLowStockItems() override {
-        if (itemCount == 0) {
-            cout << "No items available!" << endl;
-            return;
+    // Runs the event loop; only returns if a socket could not be set up
+    bool run(const ServerOptions &options) {
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        listenFd = listenOn(options.address);
+        if (epollFd == -1 || listenFd == -1) {
+            cout << "Could not listen on " << options.address << ": " << strerror(errno) << endl;
+            return false;
+        }
+        if (!options.replicationAddress.empty()) {
+            replicationFd = listenOn(options.replicationAddress);
+            if (replicationFd == -1) {
+                cout << "Could not listen on " << options.replicationAddress << ": " << strerror(errno) << endl;
+                return false;
+            }
+            acceptFollowers();
         }
+        if (!options.primaryAddress.empty()) {
+            primaryFd = connectTo(options.primaryAddress);
+            if (primaryFd == -1) {
+                cout << "Could not reach the primary at " << options.primaryAddress << ": " << strerror(errno) << endl;
+                return false;
+            }
+            readOnly = true;
+            followPrimary();
+        }
+        cout << "Serving inventory on " << options.address << (readOnly ? " (read-only follower)" : "") << endl;
+        acceptClients();
+
+        epoll_event events[256];
+        while (true) {
+            int ready = epoll_wait(epollFd, events, 256, -1);
+            for (int i = 0; i < ready; ++i) {
+                auto waiting = parked.find(events[i].data.fd);
+                if (waiting == parked.end())
+                    continue;
+                coroutine_handle<> coroutine = waiting->second;
+                parked.erase(waiting);
+                coroutine.resume();
+            }
+        }
+    }
+};
+#endif
 
-        cout << left << setw(10) << "ID" << setw(20) << "Name" << setw(10) << "Quantity"
-             << setw(10) << "Price" << setw(15) << "Category" << endl;
+// Periodically writes the manager's metrics in Prometheus text format for a
+// node exporter textfile collector or similar. Each dump goes to a temporary
+// file that is then renamed over the target, so readers never see a partial one.
+class StatsDumper {
+public:
+    StatsDumper(const ItemManager &manager, const string &path, int intervalSeconds)
+        : manager(manager), path(path), interval(max(intervalSeconds, 1)), stopping(false),
+          worker(&StatsDumper::run, this) {}
 
-        bool found = false;
-        for (int i = 0; i < itemCount; i++) {
-            if (items[i]->getQuantity() <=5) {  // Assuming low stock is less than 5
-                items[i]->display();
-                found = true;
-            }
+    ~StatsDumper() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
         }
-        if (!found) {
-            cout << "No low stock items found!" << endl;
+        wake.notify_one();
+        worker.join();
+        dump();  // Final totals on shutdown
+    }
+
+private:
+    const ItemManager &manager;
+    string path;
+    chrono::seconds interval;
+    bool stopping;
+    mutex lock;
+    condition_variable wake;
+    thread worker;  // Declared last so it starts once everything above exists
+
+    void run() {
+        unique_lock<mutex> guard(lock);
+        while (!wake.wait_for(guard, interval, [this] { return stopping; }))
+            dump();
+    }
+
+    void dump() const {
+        string temporary = path + ".tmp";
+        {
+            ofstream out(temporary);
+            manager.statistics().writePrometheus(out);
+            if (!out)
+                return;
         }
+        rename(temporary.c_str(), path.c_str());
     }
 };
 
-int main() {
+int main(int argc, char *argv[]) {
     ItemManager manager;
     int choice;
 
+    // Options: --stats-file <path> [--stats-interval <seconds>] dumps metrics
+    // periodically, in either mode. --trace-file <path> is where a tracing
+    // build writes its spans, on exit from the menu or on the TRACE request.
+    // --memory-budget <MiB> caps the inventory's tracked heap usage.
+    // --storage mmap:<file> | lsm:<directory> keeps the inventory across
+    // restarts; by default it lives in memory only.
+    // Server mode: midterm_project_oop --serve <socket path | port>
+    //     [--replicate <address> | --follow <primary replication address>]
+    string serveAddress, replicationAddress, primaryAddress, statsPath, storageSpec;
+    int statsInterval = 10;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string option = argv[i];
+        if (option == "--serve")
+            serveAddress = argv[i + 1];
+        else if (option == "--replicate")
+            replicationAddress = argv[i + 1];
+        else if (option == "--follow")
+            primaryAddress = argv[i + 1];
+        else if (option == "--stats-file")
+            statsPath = argv[i + 1];
+        else if (option == "--stats-interval")
+            statsInterval = atoi(argv[i + 1]);
+        else if (option == "--trace-file")
+            setTraceOutput(argv[i + 1]);
+        else if (option == "--memory-budget")
+            MemoryTracker::setBudget(atoll(argv[i + 1]) * 1024 * 1024);
+        else if (option == "--storage")
+            storageSpec = argv[i + 1];
+    }
+    if (!storageSpec.empty()) {
+        size_t colon = storageSpec.find(':');
+        string kind = storageSpec.substr(0, colon);
+        string path = colon == string::npos ? "" : storageSpec.substr(colon + 1);
+        if ((kind != "mmap" && kind != "lsm") || path.empty()) {
+            cout << "Unknown storage " << storageSpec << "; expected mmap:<file> or lsm:<directory>." << endl;
+            return 1;
+        }
+        InventoryStatus status = manager.openStorage(kind == "mmap" ? STORAGE_MAPPED : STORAGE_LSM, path);
+        if (status != STATUS_OK) {
+            cout << "Could not open storage " << path << ": " << statusMessage(status) << endl;
+            return 1;
+        }
+    }
+    unique_ptr<StatsDumper> statsDumper;
+    if (!statsPath.empty())
+        statsDumper = make_unique<StatsDumper>(manager, statsPath, statsInterval);
+
+    if (!serveAddress.empty()) {
+#ifdef __linux__
+        ServerOptions options;
+        options.address = serveAddress;
+        options.replicationAddress = replicationAddress;
+        options.primaryAddress = primaryAddress;
+        InventoryServer server(manager);
+        return server.run(options) ? 0 : 1;
+#else
+        cout << "Server mode is only supported on Linux." << endl;
+        return 1;
+#endif
+    }
+
+    ConsoleMenu menu(manager);
     do {
         cout << "\nMenu " << endl;
         cout << "1. Add Item" << endl;
@@ -386,42 +567,55 @@ int main() {
         cout << "6. Search Item" << endl;
         cout << "7. Sort Items" << endl;
         cout << "8. Display Low Stock Items" << endl;
-        cout << "9. Exit" << endl;
+        cout << "9. Show Statistics" << endl;
+        cout << "10. Show Memory Usage" << endl;
+        cout << "11. Show Fast Movers" << endl;
+        cout << "12. Exit" << endl;
         cout << "Choose an option: ";
         cin >> choice;
 
         switch (choice) {
             case 1:
-                manager.addItem();
+                menu.addItem();
                 break;
             case 2:
-                manager.displayAllItems();
+                menu.displayAllItems();
                 break;
             case 3:
-                manager.updateItem();
+                menu.updateItem();
                 break;
             case 4:
-                manager.removeItems();
+                menu.removeItems();
                 break;
             case 5:
-                manager.displayItemsByCategory();
+                menu.displayItemsByCategory();
                 break;
             case 6:
-                manager.searchItem();
+                menu.searchItem();
                 break;
             case 7:
-                manager.sortItems();
+                menu.sortItems();
                 break;
             case 8:
-                manager.displayLowStockItems();
+                menu.displayLowStockItems();
                 break;
             case 9:
+                menu.displayStatistics();
+                break;
+            case 10:
+                menu.displayMemoryUsage();
+                break;
+            case 11:
+                menu.displayFastMovers();
+                break;
+            case 12:
+                writeTrace();
                 cout << "Exiting..." << endl;
                 break;
             default:
                 cout << "Invalid choice! Please try again." << endl;
         }
-    } while (choice != 9);
+    } while (choice != 12);
 
     return 0;
 }
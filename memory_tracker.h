@@ -0,0 +1,119 @@
+#ifndef MEMORY_TRACKER_H
+#define MEMORY_TRACKER_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <new>
+
+using namespace std;
+
+// Parts of the inventory whose heap usage is accounted separately
+enum MemoryComponent {
+    MEMORY_ITEMS,        // Item versions and the slots pointing at them
+    MEMORY_STRINGS,      // Heap buffers of item strings too long for the inline buffer
+    MEMORY_ID_INDEX,     // ID -> position hash table
+    MEMORY_COLUMNS,      // Quantity/category columns and reservation counters
+    MEMORY_QUERY_CACHE,  // Cached listings and selection bitmaps
+    MEMORY_HISTORY,      // Quantity history rings
+    MEMORY_COMPONENT_COUNT
+};
+
+inline const char *memoryComponentName(MemoryComponent component) {
+    static const char *names[MEMORY_COMPONENT_COUNT] = {"items", "strings", "id_index", "columns", "query_cache",
+                                                                "history"};
+    return names[component];
+}
+
+struct MemoryAccount {
+    atomic<int64_t> bytes{0};   // Currently allocated
+    atomic<int64_t> blocks{0};  // Live allocations
+    atomic<int64_t> peak{0};    // Highest bytes seen
+};
+
+// Process-wide byte counts per component, plus an optional budget on their
+// total. Counting is a few relaxed atomic adds per allocation.
+class MemoryTracker {
+public:
+    static MemoryAccount &account(MemoryComponent component) {
+        static MemoryAccount accounts[MEMORY_COMPONENT_COUNT];
+        return accounts[component];
+    }
+
+    static void allocated(MemoryComponent component, size_t bytes) {
+        MemoryAccount &target = account(component);
+        int64_t now = target.bytes.fetch_add(static_cast<int64_t>(bytes), memory_order_relaxed) + bytes;
+        target.blocks.fetch_add(1, memory_order_relaxed);
+        int64_t peak = target.peak.load(memory_order_relaxed);
+        while (now > peak && !target.peak.compare_exchange_weak(peak, now, memory_order_relaxed)) {
+        }
+    }
+
+    static void released(MemoryComponent component, size_t bytes) {
+        MemoryAccount &target = account(component);
+        target.bytes.fetch_sub(static_cast<int64_t>(bytes), memory_order_relaxed);
+        target.blocks.fetch_sub(1, memory_order_relaxed);
+    }
+
+    static int64_t totalBytes() {
+        int64_t total = 0;
+        for (int component = 0; component < MEMORY_COMPONENT_COUNT; ++component)
+            total += account(static_cast<MemoryComponent>(component)).bytes.load(memory_order_relaxed);
+        return total;
+    }
+
+    // 0 means unlimited
+    static void setBudget(int64_t bytes) { budget().store(bytes); }
+    static int64_t getBudget() { return budget().load(); }
+
+    static bool overBudget(size_t extra = 0) {
+        int64_t limit = getBudget();
+        return limit > 0 && totalBytes() + static_cast<int64_t>(extra) > limit;
+    }
+
+private:
+    static atomic<int64_t> &budget() {
+        static atomic<int64_t> limit(0);
+        return limit;
+    }
+};
+
+// Standard allocator that charges what it hands out to a component. It is
+// stateless, so containers using it stay as cheap to move and swap as before.
+template <typename T, MemoryComponent Component>
+struct TrackingAllocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind {
+        using other = TrackingAllocator<U, Component>;
+    };
+
+    TrackingAllocator() noexcept = default;
+
+    template <typename U>
+    TrackingAllocator(const TrackingAllocator<U, Component> &) noexcept {}
+
+    T *allocate(size_t count) {
+        T *memory = allocator<T>().allocate(count);
+        MemoryTracker::allocated(Component, count * sizeof(T));
+        return memory;
+    }
+
+    void deallocate(T *memory, size_t count) noexcept {
+        MemoryTracker::released(Component, count * sizeof(T));
+        allocator<T>().deallocate(memory, count);
+    }
+};
+
+template <typename T, typename U, MemoryComponent Component>
+bool operator==(const TrackingAllocator<T, Component> &, const TrackingAllocator<U, Component> &) {
+    return true;
+}
+
+template <typename T, typename U, MemoryComponent Component>
+bool operator!=(const TrackingAllocator<T, Component> &, const TrackingAllocator<U, Component> &) {
+    return false;
+}
+
+#endif  // MEMORY_TRACKER_H
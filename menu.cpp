@@ -0,0 +1,354 @@
+#include "menu.h"
+
+void ConsoleMenu::addItem() {
+    string id, name, category, quantityStr, priceStr;
+    int quantity;
+    double price;
+    bool isDuplicate = true;
+
+    // Input and validate category (case-insensitive); an unknown one can be created
+    bool validCategory;
+    do {
+        cout << "Enter Category (" << categoryList() << "): ";
+        cin >> category;
+
+        validCategory = manager.isValidCategory(category);
+        if (!validCategory) {
+            char create;
+            cout << "There is no " << category << " category. Create it? (Y/N): ";
+            cin >> create;
+            if (toupper(create) == 'Y') {
+                InventoryStatus status = manager.defineCategory(category);
+                validCategory = status == STATUS_OK;
+                if (!validCategory)
+                    cout << "The category could not be created: " << statusMessage(status) << "." << endl;
+            }
+        }
+    } while (!validCategory);
+
+    // Check for duplicate IDs
+    while (isDuplicate) {
+        cout << "Enter Item ID: ";
+        cin >> id;
+
+        ItemView existing;
+        isDuplicate = manager.find(id, existing) == STATUS_OK;
+        if (isDuplicate) {  // Prompt again if the ID already exists
+            cout << "ERROR: An item already has that ID, please enter another ID.\n";
+        }
+    }
+
+    cout << "Enter Item Name: ";
+    cin.ignore();
+    getline(cin, name);
+
+    // Validate quantity input to ensure it's greater than 0
+    do {
+        cout << "Enter Quantity: ";
+        cin >> quantityStr;
+        if (!isValidNumericString(quantityStr) || stoi(quantityStr) <= 0) {
+            cout << "Input a valid quantity! Quantity must be greater than 0." << endl;
+        }
+    } while (!isValidNumericString(quantityStr) || stoi(quantityStr) <= 0);
+    quantity = stoi(quantityStr);
+
+    // Validate price input to ensure it's greater than 0
+    do {
+        cout << "Enter Price: ";
+        cin >> priceStr;
+        if (!isValidNumericString(priceStr) || stod(priceStr) <= 0) {
+            cout << "Input a valid price! Price must be greater than 0." << endl;
+        }
+    } while (!isValidNumericString(priceStr) || stod(priceStr) <= 0);
+    price = stod(priceStr);
+
+    // Add the item to the inventory, unless another writer took the ID meanwhile
+    InventoryStatus status = manager.add(id, name, quantity, price, category);
+    if (status == STATUS_OVER_MEMORY_BUDGET) {
+        cout << "ERROR: The memory budget is used up, the item was not added." << endl;
+        return;
+    }
+    if (status == STATUS_DUPLICATE_ID) {
+        cout << "ERROR: An item already has that ID, the item was not added." << endl;
+        return;
+    }
+    if (status != STATUS_OK) {
+        cout << "ERROR: The item was not added: " << statusMessage(status) << "." << endl;
+        return;
+    }
+    cout << "Item added successfully!" << endl;
+}
+
+void ConsoleMenu::updateItem() {
+    if (manager.isEmpty()) {
+        cout << "No items available to update!" << endl;
+        return;
+    }
+
+    string id, newQuantityStr, newPriceStr;
+    cout << "Enter Item ID: ";
+    cin >> id;
+
+    ItemView item;
+    if (manager.find(id, item) != STATUS_OK) {
+        cout << "Item not found!" << endl;
+        return;
+    }
+    const string &name = item->getName();
+
+    int choice;
+    cout << "Update (1- Quantity, 2- Price): ";
+    cin >> choice;
+
+    int newQuantity = 0;
+    double newPrice = 0;
+    if (choice == 1) {
+        do {
+            cout << "Enter new Quantity: ";
+            cin >> newQuantityStr;
+            if (!isValidNumericString(newQuantityStr) || stoi(newQuantityStr) < 0) {
+                cout << "Invalid quantity! Please enter a valid positive number." << endl;
+            }
+        } while (!isValidNumericString(newQuantityStr) || stoi(newQuantityStr) < 0);
+        newQuantity = stoi(newQuantityStr);
+    } else if (choice == 2) {
+        do {
+            cout << "Enter new Price: ";
+            cin >> newPriceStr;
+            if (!isValidNumericString(newPriceStr) || stod(newPriceStr) < 0) {
+                cout << "Invalid price! Please enter a valid positive number." << endl;
+            }
+        } while (!isValidNumericString(newPriceStr) || stod(newPriceStr) < 0);
+        newPrice = stod(newPriceStr);
+    } else {
+        cout << "Invalid option!" << endl;
+        return;
+    }
+
+    // The writer thread applies the change; the item may have gone while prompting
+    InventoryStatus status = (choice == 1) ? manager.submitUpdate(id, UPDATE_QUANTITY, newQuantity).get()
+                                           : manager.submitUpdate(id, UPDATE_PRICE, newPrice).get();
+    if (status == STATUS_NOT_FOUND)
+        cout << "Item not found!" << endl;
+    else if (status != STATUS_OK)
+        cout << "The item was not updated: " << statusMessage(status) << "." << endl;
+    else if (choice == 1)
+        cout << "Quantity of Item " << name << " is updated!" << endl;
+    else
+        cout << "Price of Item " << name << " is updated!" << endl;
+}
+
+void ConsoleMenu::removeItems() {
+    if (manager.isEmpty()) {
+        cout << "There is nothing to remove!" << endl;
+        return;
+    }
+    string id;
+    cout << "Enter Item ID: ";
+    cin >> id;
+    toUpperCase(id);
+
+    ItemView removed;
+    InventoryStatus status = manager.remove(id, &removed);
+    if (status == STATUS_NOT_FOUND) {
+        cout << "Item with ID " << id << " was not found." << endl;
+        return;
+    }
+    if (status != STATUS_OK) {
+        cout << "Item " << id << " was not removed: " << statusMessage(status) << "." << endl;
+        return;
+    }
+
+    cout << "Item " << removed->getName() << " has been removed from the inventory." << endl;
+}
+
+void ConsoleMenu::displayAllItems() {
+    if (manager.isEmpty()) {
+        cout << "No items available!" << endl;
+        return;
+    }
+
+    Snapshot rows;
+    manager.query({LIST_ALL, ""}, rows);
+    displayPaged(rows);
+}
+
+void ConsoleMenu::displayItemsByCategory() {
+    if (manager.isEmpty()) {
+        cout << "No items available!" << endl;
+        return;
+    }
+
+    string category;
+    cout << "Enter Category (" << categoryList() << "): ";
+    cin >> category;
+    category = toUpperCase(category);
+
+    Snapshot rows;
+    bool found = manager.query({LIST_CATEGORY, category}, rows) == STATUS_OK && displayPaged(rows);
+    if (!found) {
+        cout << "No items found in the " << category << " category!" << endl;
+    }
+}
+
+void ConsoleMenu::searchItem() {
+    if (manager.isEmpty()) {
+        cout << "No items available!" << endl;
+        return;
+    }
+
+    string name;
+    cout << "Enter Item Name: ";
+    cin.ignore();
+    getline(cin, name);
+
+    ItemView item;
+    if (manager.findByName(name, item) == STATUS_OK) {
+        cout << "Item found!" << endl;
+        displayItem(*item);
+    } else {
+        cout << "Item not found!" << endl;
+    }
+}
+
+void ConsoleMenu::sortItems()
+{
+    // Check if there are items to sort
+    if (manager.isEmpty())
+    {
+        cout << "There is nothing to sort." << endl;
+        return;
+    }
+
+    // Prompt for sorting criteria, most significant key first
+    string line;
+    cout << "Sort by: 1. Quantity 2. Price 3. Name 4. ID 5. Category" << endl;
+    cout << "Enter one or more keys in priority order (e.g. 5 2 3): ";
+    cin.ignore();
+    getline(cin, line);
+
+    vector<SortKey> keys;
+    istringstream keyStream(line);
+    string field;
+    while (keyStream >> field) {
+        if (field.size() != 1 || field[0] < '1' || field[0] > '5') {
+            cout << "Invalid sort key: " << field << endl;
+            return;
+        }
+        keys.push_back({static_cast<SortField>(field[0] - '0'), true});
+    }
+    if (keys.empty()) {
+        cout << "No sort key given!" << endl;
+        return;
+    }
+
+    // Ask for sort order of each key
+    for (SortKey &key : keys) {
+        char orderChoice;
+        cout << "Sort " << sortFieldName(key.field) << " in ascending order? (Y/N): ";
+        cin >> orderChoice;
+        key.ascending = (toupper(orderChoice) == 'Y');
+    }
+
+    manager.sortBy(keys);
+}
+
+void ConsoleMenu::displayLowStockItems() {
+    if (manager.isEmpty()) {
+        cout << "No items available!" << endl;
+        return;
+    }
+
+    Snapshot rows;
+    manager.query({LIST_LOW_STOCK, ""}, rows);
+    bool found = displayPaged(rows);
+    if (!found) {
+        cout << "No low stock items found!" << endl;
+    }
+}
+
+void ConsoleMenu::displayStatistics() {
+    manager.statistics().writeSummary(cout);
+}
+
+void ConsoleMenu::displayMemoryUsage() {
+    manager.writeMemoryReport(cout);
+}
+
+void ConsoleMenu::displayFastMovers() {
+    vector<pair<ItemView, double>> movers;
+    manager.topMovers(PAGE_SIZE, movers);
+    if (movers.empty()) {
+        cout << "No recent sales!" << endl;
+        return;
+    }
+
+    ios::fmtflags flags = cout.flags();
+    streamsize precision = cout.precision();
+    cout << left << setw(10) << "ID" << setw(20) << "Name" << setw(10) << "Quantity" << setw(14) << "Sold/day"
+         << setw(14) << "7-day avg" << endl;
+    for (const auto &[item, rate] : movers) {
+        double weekly = 0;
+        manager.salesVelocity(item->getId(), 7, weekly);
+        cout << left << setw(10) << item->getId() << setw(20) << item->getName() << setw(10) << item->getQuantity()
+             << fixed << setprecision(2) << setw(14) << rate << setw(14) << weekly << endl;
+    }
+    cout.flags(flags);
+    cout.precision(precision);
+}
+
+string ConsoleMenu::categoryList() const {
+    string list;
+    for (int code = 0; code < manager.categoryCount(); ++code) {
+        const string &name = manager.categoryName(static_cast<uint8_t>(code));
+        if (code > 0)
+            list += ", ";
+        list += name[0];
+        for (size_t i = 1; i < name.size(); ++i)
+            list += static_cast<char>(tolower(static_cast<unsigned char>(name[i])));
+    }
+    return list;
+}
+
+void ConsoleMenu::displayHeader() {
+    cout << left << setw(10) << "ID" << setw(20) << "Name" << setw(10) << "Quantity"
+         << setw(10) << "Price" << setw(15) << "Category" << endl;
+}
+
+void ConsoleMenu::displayItem(const Item &item) {
+    cout << left << setw(10) << item.getId() << setw(20) << item.getName() << setw(10) << item.getQuantity()
+         << setw(10) << item.getPrice() << setw(15) << item.getCategory() << endl;
+}
+
+bool ConsoleMenu::displayPaged(const Snapshot &rows) {
+    displayHeader();
+    if (rows.empty())
+        return false;
+
+    auto row = rows.begin();
+    while (true) {
+        {
+            TRACE_SPAN("formatPage");
+            for (int shown = 0; shown < PAGE_SIZE && row != rows.end(); ++shown, ++row)
+                displayItem(**row);
+        }
+        if (row == rows.end())
+            return true;
+
+        char more;
+        cout << "Show next page? (Y/N): ";
+        cin >> more;
+        if (toupper(more) != 'Y')
+            return true;
+    }
+}
+
+const char *ConsoleMenu::sortFieldName(SortField field) {
+    switch (field) {
+        case SORT_QUANTITY: return "Quantity";
+        case SORT_PRICE: return "Price";
+        case SORT_NAME: return "Name";
+        case SORT_ID: return "ID";
+        default: return "Category";
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef MENU_H
+#define MENU_H
+
+#include "inventory.h"
+
+// Interactive console front end. It prompts, validates input and prints
+// results, and reaches the inventory only through ItemManager's public API.
+class ConsoleMenu {
+public:
+    explicit ConsoleMenu(ItemManager &manager) : manager(manager) {}
+
+    void addItem();
+    void displayAllItems();
+    void updateItem();
+    void removeItems();
+    void displayItemsByCategory();
+    void searchItem();
+    void sortItems();
+    void displayLowStockItems();
+    void displayStatistics();
+    void displayMemoryUsage();
+    void displayFastMovers();
+
+private:
+    ItemManager &manager;
+
+    static const int PAGE_SIZE = 10;  // Rows shown per page in listings
+
+    // Category names for prompts, e.g. "Clothing, Electronics, Entertainment"
+    string categoryList() const;
+
+    static void displayHeader();
+    static void displayItem(const Item &item);
+
+    // Lists a snapshot a page at a time. Each page resumes the snapshot's
+    // iterator where the last one stopped, so later pages never revisit rows
+    // that were already shown, and writers are not held up however long the
+    // user takes to page through.
+    static bool displayPaged(const Snapshot &rows);
+
+    static const char *sortFieldName(SortField field);
+};
+
+#endif // MENU_H
@@ -0,0 +1,249 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+using namespace std;
+
+// Operations ItemManager keeps latency histograms and counters for
+enum MetricOp {
+    METRIC_ADD,
+    METRIC_UPDATE,
+    METRIC_DELTAS,
+    METRIC_REMOVE,
+    METRIC_RESERVE,
+    METRIC_RELEASE,
+    METRIC_COMMIT,
+    METRIC_LOOKUP_ID,
+    METRIC_LOOKUP_NAME,
+    METRIC_LIST,
+    METRIC_SORT,
+    METRIC_OP_COUNT
+};
+
+inline const char *metricOpName(MetricOp op) {
+    static const char *names[METRIC_OP_COUNT] = {"add",    "update",    "deltas",      "remove", "reserve", "release",
+                                                 "commit", "lookup_id", "lookup_name", "list",   "sort"};
+    return names[op];
+}
+
+// Cheap timestamp in ticks: the TSC on x86 (a few nanoseconds to read), the
+// steady clock in nanoseconds elsewhere
+inline uint64_t metricTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Ticks per nanosecond, measured once on first use. Only reports call this,
+// so the hot path never pays for the calibration.
+inline double ticksPerNanosecond() {
+#if defined(__x86_64__) || defined(__i386__)
+    static const double rate = [] {
+        auto startTime = chrono::steady_clock::now();
+        uint64_t startTicks = metricTicks();
+        this_thread::sleep_for(chrono::milliseconds(20));
+        uint64_t ticks = metricTicks() - startTicks;
+        auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - startTime).count();
+        return elapsed > 0 ? static_cast<double>(ticks) / elapsed : 1.0;
+    }();
+    return rate;
+#else
+    return 1.0;
+#endif
+}
+
+// HDR-style log-linear histogram: values below SUB_BUCKETS get a bucket each,
+// larger ones are split into SUB_BUCKETS buckets per power of two, so any
+// recorded value is off by at most 1/16 (6.25%). Recording is two relaxed
+// atomic adds.
+class LatencyHistogram {
+public:
+    static const int SUB_BUCKET_BITS = 4;
+    static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const int BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    void record(uint64_t value) {
+        counts[bucketOf(value)].fetch_add(1, memory_order_relaxed);
+        sum.fetch_add(value, memory_order_relaxed);
+    }
+
+    static int bucketOf(uint64_t value) {
+        if (value < SUB_BUCKETS)
+            return static_cast<int>(value);
+        int exponent = 63 - __builtin_clzll(value);
+        int sub = static_cast<int>((value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+        return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+    }
+
+    // Smallest value that no longer falls into the bucket
+    static uint64_t bucketLimit(int bucket) {
+        if (bucket < SUB_BUCKETS)
+            return bucket + 1;
+        int shift = bucket / SUB_BUCKETS - 1;
+        uint64_t low = static_cast<uint64_t>(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+        uint64_t width = 1ULL << shift;
+        return low > UINT64_MAX - width ? UINT64_MAX : low + width;
+    }
+
+    uint64_t count(int bucket) const { return counts[bucket].load(memory_order_relaxed); }
+    uint64_t total() const { return sum.load(memory_order_relaxed); }
+
+    uint64_t population() const {
+        uint64_t recorded = 0;
+        for (int i = 0; i < BUCKET_COUNT; ++i)
+            recorded += count(i);
+        return recorded;
+    }
+
+    // Upper bound of the bucket holding the given quantile, or 0 if empty
+    uint64_t quantile(double fraction) const {
+        uint64_t population = this->population();
+        if (population == 0)
+            return 0;
+        uint64_t rank = static_cast<uint64_t>(fraction * (population - 1)) + 1, seen = 0;
+        for (int i = 0; i < BUCKET_COUNT; ++i) {
+            seen += count(i);
+            if (seen >= rank)
+                return bucketLimit(i) - 1;
+        }
+        return bucketLimit(BUCKET_COUNT - 1) - 1;
+    }
+
+private:
+    atomic<uint64_t> counts[BUCKET_COUNT] = {};
+    atomic<uint64_t> sum{0};
+};
+
+// Counters and latency histogram for one operation type. The histogram
+// doubles as the operation count, so a successful operation costs two atomic
+// adds. Aligned so operations updated from different threads do not share
+// cache lines.
+struct alignas(64) OperationMetrics {
+    atomic<uint64_t> misses{0};    // Not found / rejected
+    atomic<uint64_t> scanned{0};   // Rows examined by linear scans
+    atomic<uint64_t> allocated{0}; // Bytes of item versions and copies created
+    LatencyHistogram latency;      // In metricTicks() units
+
+    uint64_t operations() const { return latency.population(); }
+    uint64_t hits() const { return operations() - misses.load(); }
+};
+
+class Metrics {
+public:
+    OperationMetrics &operator[](MetricOp op) { return operations[op]; }
+    const OperationMetrics &operator[](MetricOp op) const { return operations[op]; }
+
+    void addScanned(MetricOp op, uint64_t rows) { operations[op].scanned.fetch_add(rows, memory_order_relaxed); }
+    void addAllocated(MetricOp op, uint64_t bytes) { operations[op].allocated.fetch_add(bytes, memory_order_relaxed); }
+
+    // Prometheus text exposition format (version 0.0.4)
+    void writePrometheus(ostream &out) const {
+        static const double LATENCY_BOUNDS[] = {1e-7, 2.5e-7, 5e-7, 1e-6, 2.5e-6, 5e-6, 1e-5, 2.5e-5, 5e-5,
+                                                1e-4, 2.5e-4, 5e-4, 1e-3, 2.5e-3, 5e-3, 1e-2, 0.1,    1.0,  10.0};
+        double ticksPerSecond = ticksPerNanosecond() * 1e9;
+
+        writeCounter(out, "inventory_operations_total", "Operations performed.",
+                     [](const OperationMetrics &m) { return m.operations(); });
+        writeCounter(out, "inventory_operation_hits_total", "Operations that found or applied their item.",
+                     [](const OperationMetrics &m) { return m.hits(); });
+        writeCounter(out, "inventory_operation_misses_total", "Operations that missed or were rejected.",
+                     [](const OperationMetrics &m) { return m.misses.load(); });
+        writeCounter(out, "inventory_items_scanned_total", "Rows examined by linear scans.",
+                     [](const OperationMetrics &m) { return m.scanned.load(); });
+        writeCounter(out, "inventory_bytes_allocated_total", "Approximate bytes of item versions and copies created.",
+                     [](const OperationMetrics &m) { return m.allocated.load(); });
+
+        out << "# HELP inventory_operation_duration_seconds Operation latency.\n"
+            << "# TYPE inventory_operation_duration_seconds histogram\n";
+        for (int op = 0; op < METRIC_OP_COUNT; ++op) {
+            const LatencyHistogram &latency = operations[op].latency;
+            const char *name = metricOpName(static_cast<MetricOp>(op));
+            uint64_t cumulative = 0;
+            int bucket = 0;
+            for (double bound : LATENCY_BOUNDS) {
+                for (; bucket < LatencyHistogram::BUCKET_COUNT &&
+                       LatencyHistogram::bucketLimit(bucket) <= bound * ticksPerSecond;
+                     ++bucket)
+                    cumulative += latency.count(bucket);
+                out << "inventory_operation_duration_seconds_bucket{op=\"" << name << "\",le=\"" << bound << "\"} "
+                    << cumulative << "\n";
+            }
+            for (; bucket < LatencyHistogram::BUCKET_COUNT; ++bucket)
+                cumulative += latency.count(bucket);
+            out << "inventory_operation_duration_seconds_bucket{op=\"" << name << "\",le=\"+Inf\"} " << cumulative
+                << "\n";
+            out << "inventory_operation_duration_seconds_sum{op=\"" << name << "\"} "
+                << latency.total() / ticksPerSecond << "\n";
+            out << "inventory_operation_duration_seconds_count{op=\"" << name << "\"} " << cumulative << "\n";
+        }
+    }
+
+    // Human-readable table of the operations that have run
+    void writeSummary(ostream &out) const {
+        double ticksPerMicrosecond = ticksPerNanosecond() * 1e3;
+        out << left << setw(12) << "Operation" << right << setw(10) << "Count" << setw(10) << "Misses" << setw(12)
+            << "Scanned" << setw(10) << "p50 us" << setw(10) << "p99 us" << setw(10) << "p99.9 us" << endl;
+        for (int op = 0; op < METRIC_OP_COUNT; ++op) {
+            const OperationMetrics &m = operations[op];
+            uint64_t count = m.operations();
+            if (count == 0)
+                continue;
+            out << left << setw(12) << metricOpName(static_cast<MetricOp>(op)) << right << setw(10) << count
+                << setw(10) << m.misses.load() << setw(12) << m.scanned.load() << fixed << setprecision(2)
+                << setw(10) << m.latency.quantile(0.5) / ticksPerMicrosecond << setw(10)
+                << m.latency.quantile(0.99) / ticksPerMicrosecond << setw(10)
+                << m.latency.quantile(0.999) / ticksPerMicrosecond << endl;
+        }
+    }
+
+private:
+    OperationMetrics operations[METRIC_OP_COUNT];
+
+    template <typename Value>
+    void writeCounter(ostream &out, const char *name, const char *help, Value value) const {
+        out << "# HELP " << name << " " << help << "\n# TYPE " << name << " counter\n";
+        for (int op = 0; op < METRIC_OP_COUNT; ++op)
+            out << name << "{op=\"" << metricOpName(static_cast<MetricOp>(op)) << "\"} " << value(operations[op])
+                << "\n";
+    }
+};
+
+// Times one operation and records it when it goes out of scope. The outcome
+// defaults to a miss, so early failure returns need no extra code.
+class OperationTimer {
+public:
+    OperationTimer(Metrics &metrics, MetricOp op) : metrics(metrics), op(op), start(metricTicks()) {}
+
+    ~OperationTimer() {
+        OperationMetrics &target = metrics[op];
+        target.latency.record(metricTicks() - start);
+        if (!hit)
+            target.misses.fetch_add(1, memory_order_relaxed);
+    }
+
+    // Marks the outcome and passes it through, e.g. "return timer.done(true);"
+    bool done(bool succeeded) {
+        hit = succeeded;
+        return succeeded;
+    }
+
+private:
+    Metrics &metrics;
+    MetricOp op;
+    uint64_t start;
+    bool hit = false;
+};
+
+#endif  // METRICS_H
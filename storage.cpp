@@ -0,0 +1,371 @@
+#include "storage.h"
+
+#include <algorithm>
+#include <filesystem>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static const char MAPPED_MAGIC[8] = {'I', 'N', 'V', 'M', 'A', 'P', '0', '1'};
+
+MappedStorage::~MappedStorage() {
+    close();
+}
+
+#ifdef __linux__
+bool MappedStorage::open(const string &file) {
+    close();
+    path = file;
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd == -1)
+        return false;
+    struct stat status;
+    if (fstat(fd, &status) == -1)
+        return false;
+
+    bool created = static_cast<size_t>(status.st_size) < HEADER_SIZE;
+    if (created && ftruncate(fd, INITIAL_SIZE) == -1)
+        return false;
+    capacity = created ? INITIAL_SIZE : static_cast<size_t>(status.st_size);
+    void *memory = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED) {
+        mapping = nullptr;
+        return false;
+    }
+    mapping = static_cast<char *>(memory);
+
+    if (created) {
+        memcpy(mapping, MAPPED_MAGIC, sizeof MAPPED_MAGIC);
+        setUsed(HEADER_SIZE);
+    }
+    return memcmp(mapping, MAPPED_MAGIC, sizeof MAPPED_MAGIC) == 0 && used() >= HEADER_SIZE && used() <= capacity;
+}
+
+void MappedStorage::close() {
+    if (mapping)
+        munmap(mapping, capacity);
+    if (fd != -1)
+        ::close(fd);
+    mapping = nullptr;
+    fd = -1;
+    capacity = 0;
+}
+
+bool MappedStorage::reserve(size_t bytes) {
+    if (bytes <= capacity)
+        return true;
+    size_t grown = capacity;
+    while (grown < bytes)
+        grown *= 2;
+    if (ftruncate(fd, grown) == -1)
+        return false;
+    void *memory = mremap(mapping, capacity, grown, MREMAP_MAYMOVE);
+    if (memory == MAP_FAILED)
+        return false;
+    mapping = static_cast<char *>(memory);
+    capacity = grown;
+    return true;
+}
+#else
+bool MappedStorage::open(const string &) {
+    return false;  // Memory-mapped storage is only supported on Linux
+}
+
+void MappedStorage::close() {}
+
+bool MappedStorage::reserve(size_t) {
+    return false;
+}
+#endif
+
+uint64_t MappedStorage::used() const {
+    uint64_t bytes;
+    memcpy(&bytes, mapping + sizeof MAPPED_MAGIC, sizeof bytes);
+    return bytes;
+}
+
+void MappedStorage::setUsed(uint64_t bytes) {
+    memcpy(mapping + sizeof MAPPED_MAGIC, &bytes, sizeof bytes);
+}
+
+bool MappedStorage::append(const string &records) {
+    uint64_t end = used();
+    if (!reserve(end + records.size()))
+        return false;
+    // Copy the batch before publishing its length, so a crash mid-copy loses
+    // the whole batch rather than leaving half of it
+    memcpy(mapping + end, records.data(), records.size());
+    setUsed(end + records.size());
+    return true;
+}
+
+bool MappedStorage::rewrite(const vector<string> &live) {
+    // Build the compacted file beside the old one and swap it in, so a crash
+    // leaves one or the other intact
+    string temporary = path + ".tmp";
+    {
+        ofstream out(temporary, ios::binary | ios::trunc);
+        uint64_t bytes = HEADER_SIZE;
+        for (const string &record : live)
+            bytes += record.size();
+        out.write(MAPPED_MAGIC, sizeof MAPPED_MAGIC);
+        out.write(reinterpret_cast<const char *>(&bytes), sizeof bytes);
+        for (const string &record : live)
+            out.write(record.data(), static_cast<streamsize>(record.size()));
+        if (!out)
+            return false;
+    }
+    error_code error;
+    filesystem::rename(temporary, path, error);
+    return !error && open(path);
+}
+
+LogStructuredStorage::~LogStructuredStorage() {
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    if (compactor.joinable())
+        compactor.join();  // A flush left unfinished is redone by the next open()
+}
+
+bool LogStructuredStorage::open(const string &location) {
+    waitIdle();
+    directory = location;
+    error_code error;
+    filesystem::create_directories(directory, error);
+    if (error)
+        return false;
+
+    // Find the runs; anything older than the newest base is already merged into it
+    runs.clear();
+    baseRun = 0;
+    vector<pair<uint64_t, bool>> found;
+    for (const auto &entry : filesystem::directory_iterator(directory, error)) {
+        string name = entry.path().filename().string();
+        bool base = name.rfind("base-", 0) == 0;
+        if (!base && name.rfind("run-", 0) != 0)
+            continue;
+        const char *digits = name.c_str() + (base ? 5 : 4);
+        char *end = nullptr;
+        uint64_t sequence = strtoull(digits, &end, 10);
+        if (end == digits || *end != '\0')
+            continue;  // e.g. a run left half-written as run-<n>.tmp
+        found.emplace_back(sequence, base);
+        if (base)
+            baseRun = max(baseRun, sequence);
+    }
+    if (error)
+        return false;
+    sort(found.begin(), found.end());
+    for (const auto &[sequence, base] : found) {
+        if (sequence >= baseRun && (!base || sequence == baseRun))
+            runs.push_back(sequence);
+        else
+            filesystem::remove(directory + (base ? "/base-" : "/run-") + to_string(sequence), error);
+    }
+
+    // Finish a flush that was cut short: the set-aside log becomes a run
+    string contents;
+    if (!readFile(oldLogPath(), contents))
+        return false;
+    map<string, string> old;
+    parseRecords(contents, old);
+    if (!old.empty() && !writeRun(old, false))
+        return false;
+    filesystem::remove(oldLogPath(), error);
+    if (error)
+        return false;
+
+    // Refill the table from the log, cutting off a torn last batch so later
+    // appends do not land behind it
+    if (!readFile(logPath(), contents))
+        return false;
+    table.clear();
+    logBytes = parseRecords(contents, table);
+    if (logBytes < contents.size())
+        filesystem::resize_file(logPath(), logBytes, error);
+
+    log.close();
+    log.clear();
+    log.open(logPath(), ios::binary | ios::app);
+    if (!compactor.joinable())
+        compactor = thread(&LogStructuredStorage::compact, this);
+    return !error && log.is_open();
+}
+
+string LogStructuredStorage::runPath(uint64_t run) const {
+    return directory + (run == baseRun ? "/base-" : "/run-") + to_string(run);
+}
+
+string LogStructuredStorage::logPath() const {
+    return directory + "/log";
+}
+
+string LogStructuredStorage::oldLogPath() const {
+    return directory + "/log.old";
+}
+
+bool LogStructuredStorage::append(const string &records) {
+    if (!log.is_open()) {
+        log.clear();
+        log.open(logPath(), ios::binary | ios::app);
+    }
+    log.write(records.data(), static_cast<streamsize>(records.size()));
+    log.flush();
+    if (!log) {
+        // Cut off whatever part of the batch got through, so the next batch
+        // does not end up behind a torn record
+        log.close();
+        error_code error;
+        filesystem::resize_file(logPath(), logBytes, error);
+        return false;
+    }
+    logBytes += records.size();
+    parseRecords(records, table);
+    if (table.size() >= TABLE_LIMIT)
+        freezeTable();
+    return true;  // The batch is in the log; writing runs can fail and retry on its own
+}
+
+void LogStructuredStorage::freezeTable() {
+    lock_guard<mutex> guard(lock);
+    if (flushing)
+        return;  // The table keeps growing until the compactor has caught up
+
+    log.close();
+    log.clear();
+    error_code error;
+    filesystem::rename(logPath(), oldLogPath(), error);
+    if (error) {
+        log.open(logPath(), ios::binary | ios::app);  // Try again on the next append
+        return;
+    }
+    log.open(logPath(), ios::binary | ios::trunc);
+    logBytes = 0;
+    frozen.swap(table);
+    table.clear();
+    flushing = true;
+    wake.notify_all();
+}
+
+void LogStructuredStorage::compact() {
+    unique_lock<mutex> guard(lock);
+    bool written = false;  // The frozen table is in a run; only log.old is left to drop
+    while (true) {
+        wake.wait(guard, [this] { return stopping || flushing; });
+        if (!flushing)
+            return;
+
+        guard.unlock();
+        written = written || writeRun(frozen, false);
+        error_code error;
+        if (written)
+            filesystem::remove(oldLogPath(), error);
+        bool done = written && !error;
+        if (done && runs.size() > RUN_LIMIT)
+            mergeRuns();  // If this fails the runs stay as they are until the next flush
+        guard.lock();
+
+        if (done) {
+            frozen.clear();
+            flushing = false;
+            written = false;
+            wake.notify_all();
+        } else if (stopping) {
+            return;
+        } else {
+            wake.wait_for(guard, RETRY_DELAY, [this] { return stopping; });
+        }
+    }
+}
+
+void LogStructuredStorage::waitIdle() {
+    unique_lock<mutex> guard(lock);
+    wake.wait(guard, [this] { return !flushing; });
+}
+
+bool LogStructuredStorage::writeRun(const map<string, string> &records, bool base) {
+    uint64_t sequence = runs.empty() ? 1 : runs.back() + 1;
+    string path = directory + (base ? "/base-" : "/run-") + to_string(sequence);
+    {
+        ofstream out(path + ".tmp", ios::binary | ios::trunc);
+        for (const auto &entry : records)
+            out.write(entry.second.data(), static_cast<streamsize>(entry.second.size()));
+        if (!out)
+            return false;
+    }
+    error_code error;
+    filesystem::rename(path + ".tmp", path, error);
+    if (error)
+        return false;
+
+    if (base) {
+        // The base holds everything; the runs before it can go
+        for (uint64_t run : runs)
+            filesystem::remove(runPath(run), error);
+        runs.clear();
+        baseRun = sequence;
+    }
+    runs.push_back(sequence);
+    return true;
+}
+
+bool LogStructuredStorage::mergeRuns() {
+    map<string, string> merged;
+    for (uint64_t run : runs) {
+        string contents;
+        if (!readFile(runPath(run), contents) || parseRecords(contents, merged) != contents.size())
+            return false;
+    }
+    // Nothing older remains for a removal to hide
+    for (auto entry = merged.begin(); entry != merged.end();) {
+        if (entry->second[4] == RECORD_ERASE)
+            entry = merged.erase(entry);
+        else
+            ++entry;
+    }
+    return writeRun(merged, true);
+}
+
+bool LogStructuredStorage::rewrite(const vector<string> &live) {
+    waitIdle();
+    map<string, string> records;
+    for (const string &record : live)
+        records.emplace(recordId(record), record);
+    if (!writeRun(records, true))
+        return false;
+    table.clear();
+    log.close();
+    log.clear();
+    log.open(logPath(), ios::binary | ios::trunc);
+    logBytes = 0;
+    return log.is_open();
+}
+
+size_t LogStructuredStorage::parseRecords(const string &contents, map<string, string> &records) {
+    size_t offset = 0;
+    while (offset < contents.size()) {
+        size_t size = recordSize(contents.data(), contents.size(), offset);
+        if (!size)
+            break;
+        string record = contents.substr(offset, size);
+        records[recordId(record)] = move(record);
+        offset += size;
+    }
+    return offset;
+}
+
+bool LogStructuredStorage::readFile(const string &path, string &contents) {
+    contents.clear();
+    ifstream in(path, ios::binary);
+    if (!in)
+        return !filesystem::exists(path);  // A missing file is simply empty
+    contents.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    return !in.bad();
+}
@@ -0,0 +1,346 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// Storage backends keep the inventory across restarts. The engine always
+// serves reads from its in-memory columns; a backend only sees mutations,
+// as records appended under the engine's storage lock, and hands the live
+// items back when the engine starts.
+//
+// Backends share StorageBackend through CRTP: the base encodes and decodes
+// records, a backend only implements
+//     bool append(const string &records);        // One batch, written as a unit
+//     template <typename Visit>
+//     bool replay(Visit visit);                   // visit(record) oldest first
+//     bool rewrite(const vector<string> &live);   // Replace everything with live
+// and declares PERSISTENT. ItemManager holds the chosen backend in a variant
+// and dispatches with visit(), so no call goes through a vtable, and the
+// in-memory backend's record building compiles away entirely.
+
+enum StorageKind { STORAGE_MEMORY, STORAGE_MAPPED, STORAGE_LSM };
+
+// Records are [uint32 size][kind][fields...] with strings as [uint32 size][bytes]
+enum StorageRecordKind : uint8_t { RECORD_PUT = 1, RECORD_ERASE };
+
+template <typename Backend>
+class StorageBackend {
+public:
+    // Stage an item's current fields, or its removal, for the next flush()
+    void put(const string &id, const string &name, int quantity, double price, const string &category) {
+        if constexpr (Backend::PERSISTENT) {
+            size_t start = beginRecord(RECORD_PUT);
+            appendString(id);
+            appendString(name);
+            appendString(category);
+            appendValue(static_cast<int32_t>(quantity));
+            appendValue(price);
+            endRecord(start);
+        }
+    }
+
+    void erase(const string &id) {
+        if constexpr (Backend::PERSISTENT) {
+            size_t start = beginRecord(RECORD_ERASE);
+            appendString(id);
+            endRecord(start);
+        }
+    }
+
+    // Writes the staged records as one batch. They are dropped either way, so
+    // a failed flush leaves nothing behind to leak into the next one.
+    bool flush() {
+        if constexpr (Backend::PERSISTENT) {
+            bool written = staged.empty() || backend().append(staged);
+            staged.clear();
+            return written;
+        } else {
+            return true;
+        }
+    }
+
+    // Calls visit(id, name, quantity, price, category) for every stored item,
+    // in the order they were first added. Rewrites the store when removals and
+    // superseded versions make up most of it.
+    template <typename Visit>
+    bool load(Visit visit) {
+        if constexpr (Backend::PERSISTENT) {
+            vector<string> live;
+            unordered_map<string, size_t> position;
+            size_t records = 0;
+            bool valid = backend().replay([&](const string &record) {
+                string id;
+                size_t offset = 5;
+                if (!readString(record, offset, id))
+                    return false;
+                records++;
+                auto found = position.find(id);
+                if (record[4] == RECORD_ERASE) {
+                    if (found != position.end()) {
+                        live[found->second].clear();
+                        position.erase(found);
+                    }
+                } else if (found != position.end()) {
+                    live[found->second] = record;
+                } else {
+                    position.emplace(id, live.size());
+                    live.push_back(record);
+                }
+                return true;
+            });
+            if (!valid)
+                return false;
+
+            vector<string> compacted;
+            compacted.reserve(position.size());
+            for (string &record : live) {
+                if (record.empty())
+                    continue;
+                string id, name, category;
+                int32_t quantity;
+                double price;
+                size_t offset = 5;
+                if (!readString(record, offset, id) || !readString(record, offset, name) ||
+                    !readString(record, offset, category) || !readValue(record, offset, quantity) ||
+                    !readValue(record, offset, price))
+                    return false;
+                visit(id, name, quantity, price, category);
+                compacted.push_back(move(record));
+            }
+            size_t dead = records - compacted.size();
+            if (dead > REWRITE_SLACK && dead > compacted.size())
+                return backend().rewrite(compacted);
+            return true;
+        } else {
+            (void)visit;
+            return true;
+        }
+    }
+
+    // Reads the size prefix of the record starting at data[offset]; returns 0
+    // when fewer than a whole record's bytes remain (e.g. a torn last write)
+    static size_t recordSize(const char *data, size_t length, size_t offset) {
+        if (length - offset < 5)
+            return 0;
+        uint32_t size;
+        memcpy(&size, data + offset, sizeof size);
+        return (size >= 5 && size <= length - offset) ? size : 0;
+    }
+
+    // The ID a record is keyed by
+    static string recordId(const string &record) {
+        string id;
+        size_t offset = 5;
+        readString(record, offset, id);
+        return id;
+    }
+
+protected:
+    static const size_t REWRITE_SLACK = 1024;  // Dead records tolerated before a rewrite
+
+    string staged;
+
+private:
+    Backend &backend() {
+        return static_cast<Backend &>(*this);
+    }
+
+    size_t beginRecord(StorageRecordKind kind) {
+        size_t start = staged.size();
+        staged.append(4, '\0');
+        staged.push_back(static_cast<char>(kind));
+        return start;
+    }
+
+    void endRecord(size_t start) {
+        uint32_t size = static_cast<uint32_t>(staged.size() - start);
+        memcpy(&staged[start], &size, sizeof size);
+    }
+
+    template <typename T>
+    void appendValue(T value) {
+        staged.append(reinterpret_cast<const char *>(&value), sizeof value);
+    }
+
+    void appendString(const string &text) {
+        appendValue(static_cast<uint32_t>(text.size()));
+        staged += text;
+    }
+
+    template <typename T>
+    static bool readValue(const string &record, size_t &offset, T &value) {
+        if (record.size() - offset < sizeof value)
+            return false;
+        memcpy(&value, record.data() + offset, sizeof value);
+        offset += sizeof value;
+        return true;
+    }
+
+    static bool readString(const string &record, size_t &offset, string &text) {
+        uint32_t size;
+        if (!readValue(record, offset, size) || record.size() - offset < size)
+            return false;
+        text.assign(record, offset, size);
+        offset += size;
+        return true;
+    }
+};
+
+// Keeps nothing beyond the engine's own in-memory columns
+class MemoryStorage : public StorageBackend<MemoryStorage> {
+public:
+    static const bool PERSISTENT = false;
+};
+
+// A record log in a memory-mapped file. Appends are memcpy's into the page
+// cache, so a batch survives the process crashing as soon as flush() returns;
+// the kernel writes it back to disk in its own time. The file grows by
+// doubling, and the number of bytes in use is kept in its header.
+class MappedStorage : public StorageBackend<MappedStorage> {
+public:
+    static const bool PERSISTENT = true;
+
+    MappedStorage() = default;
+    ~MappedStorage();
+    MappedStorage(const MappedStorage &) = delete;
+    MappedStorage &operator=(const MappedStorage &) = delete;
+
+    bool open(const string &path);
+
+    bool append(const string &records);
+    bool rewrite(const vector<string> &live);
+
+    template <typename Visit>
+    bool replay(Visit visit) {
+        for (size_t offset = HEADER_SIZE; offset < used();) {
+            size_t size = recordSize(mapping, used(), offset);
+            if (!size || !visit(string(mapping + offset, size)))
+                return false;
+            offset += size;
+        }
+        return true;
+    }
+
+private:
+    static const size_t HEADER_SIZE = 16;  // Magic, then the bytes in use
+    static const size_t INITIAL_SIZE = 1 << 20;
+
+    string path;
+    int fd = -1;
+    char *mapping = nullptr;
+    size_t capacity = 0;
+
+    void close();
+
+    uint64_t used() const;
+    void setUsed(uint64_t bytes);
+    bool reserve(size_t bytes);  // Grows the file and the mapping to hold bytes
+};
+
+// A small log-structured merge tree in a directory. Batches go to a write-
+// ahead log and a sorted in-memory table; a batch is durable, and append()
+// succeeds, once it is in the log. When the table fills, the log is set aside
+// as log.old and a background thread writes the table out as an immutable
+// run sorted by ID, then drops log.old. Once there are too many runs the same
+// thread merges them into a base run holding only live items, which
+// supersedes every run before it. Neither step runs on the caller's thread,
+// and a failed one is retried later while the set-aside log keeps its records.
+// Runs are sorted by ID, so items come back in ID order rather than the order
+// they were added.
+class LogStructuredStorage : public StorageBackend<LogStructuredStorage> {
+public:
+    static const bool PERSISTENT = true;
+
+    LogStructuredStorage() = default;
+    ~LogStructuredStorage();
+    LogStructuredStorage(const LogStructuredStorage &) = delete;
+    LogStructuredStorage &operator=(const LogStructuredStorage &) = delete;
+
+    bool open(const string &directory);
+
+    bool append(const string &records);
+    bool rewrite(const vector<string> &live);
+
+    // Runs oldest first, then the set-aside log, then the log
+    template <typename Visit>
+    bool replay(Visit visit) {
+        waitIdle();
+        for (uint64_t run : runs) {
+            if (!replayFile(runPath(run), visit))
+                return false;
+        }
+        return replayFile(oldLogPath(), visit) && replayFile(logPath(), visit);
+    }
+
+private:
+    static const size_t TABLE_LIMIT = 1 << 14;  // Records held before writing a run
+    static const size_t RUN_LIMIT = 4;          // Runs kept before merging them
+    static constexpr chrono::seconds RETRY_DELAY{1};
+
+    string directory;
+    vector<uint64_t> runs;      // Sequence numbers, oldest first; changed only while idle or by the compactor
+    uint64_t baseRun = 0;       // Sequence number of the base run, if any
+    map<string, string> table;  // ID -> latest record since the log was last set aside
+    ofstream log;
+    uint64_t logBytes = 0;      // Bytes in the log, all of them whole batches
+
+    // Hand-off to the compactor thread. While flushing, frozen holds the
+    // records of log.old and only the compactor touches it, runs and baseRun.
+    map<string, string> frozen;
+    bool flushing = false;
+    bool stopping = false;
+    mutex lock;
+    condition_variable wake;  // Compactor: work or stop; callers: compactor idle
+    thread compactor;
+
+    string runPath(uint64_t run) const;
+    string logPath() const;
+    string oldLogPath() const;
+
+    // Writes records as the next run, or as a new base replacing all runs
+    bool writeRun(const map<string, string> &records, bool base);
+    bool mergeRuns();
+
+    // Sets the log aside and hands the table to the compactor, unless it is
+    // still busy with the previous one
+    void freezeTable();
+    void compact();
+    void waitIdle();
+
+    static bool readFile(const string &path, string &contents);
+
+    // Adds the whole records in contents to records by ID and returns the
+    // bytes they take, stopping at a torn one
+    static size_t parseRecords(const string &contents, map<string, string> &records);
+
+    template <typename Visit>
+    bool replayFile(const string &path, Visit visit) {
+        string contents;
+        if (!readFile(path, contents))
+            return false;
+        // A torn record at the end of the log is a batch that never completed
+        for (size_t offset = 0; offset < contents.size();) {
+            size_t size = recordSize(contents.data(), contents.size(), offset);
+            if (!size)
+                break;
+            if (!visit(contents.substr(offset, size)))
+                return false;
+            offset += size;
+        }
+        return true;
+    }
+};
+
+#endif // STORAGE_H
@@ -0,0 +1,173 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+
+#include "metrics.h"
+
+using namespace std;
+
+// Optional span tracing, compiled in only when INVENTORY_TRACING is defined
+// (cmake -DINVENTORY_TRACING=ON). TRACE_SPAN("name") times the rest of the
+// enclosing scope. Each thread records into its own ring buffer of the most
+// recent spans; writeTrace() saves every buffer as Chrome trace JSON, which
+// chrome://tracing and ui.perfetto.dev open directly. Without the define,
+// TRACE_SPAN expands to nothing and the functions below are no-ops.
+
+#ifdef INVENTORY_TRACING
+
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct TraceEvent {
+    const char *name;  // Always a string literal
+    uint64_t start;    // metricTicks()
+    uint64_t end;
+};
+
+// Single-writer ring: only the owning thread records. It announces each
+// position in claimed before filling the slot and publishes the event by
+// advancing head with a release store. A dump copies the slots below head
+// (acquire load), then rereads claimed and drops any slot the writer may
+// have started overwriting meanwhile: slot fields are stored with release
+// and loaded with acquire, so a field seen overwritten implies its claim is
+// seen too. A copy racing an overwrite is wasted, never undefined.
+class TraceBuffer {
+public:
+    static const size_t CAPACITY = 1 << 16;  // Events kept per thread
+
+    explicit TraceBuffer(int threadId) : threadId(threadId), slots(new Slot[CAPACITY]) {}
+
+    void record(const char *name, uint64_t start, uint64_t end) {
+        size_t position = head.load(memory_order_relaxed);
+        claimed.store(position + 1, memory_order_relaxed);
+        Slot &slot = slots[position & (CAPACITY - 1)];
+        slot.name.store(name, memory_order_release);
+        slot.start.store(start, memory_order_release);
+        slot.end.store(end, memory_order_release);
+        head.store(position + 1, memory_order_release);
+    }
+
+    // Appends the events still held, oldest first
+    void collect(vector<TraceEvent> &out) const {
+        size_t end = head.load(memory_order_acquire);
+        size_t begin = end > CAPACITY ? end - CAPACITY : 0;
+        vector<TraceEvent> copied;
+        copied.reserve(end - begin);
+        for (size_t position = begin; position < end; ++position) {
+            const Slot &slot = slots[position & (CAPACITY - 1)];
+            copied.push_back({slot.name.load(memory_order_acquire), slot.start.load(memory_order_acquire),
+                              slot.end.load(memory_order_acquire)});
+        }
+        size_t reached = claimed.load(memory_order_relaxed);
+        size_t valid = reached > CAPACITY ? reached - CAPACITY : 0;
+        size_t skip = valid > begin ? min(valid - begin, copied.size()) : 0;
+        out.insert(out.end(), copied.begin() + skip, copied.end());
+    }
+
+    const int threadId;
+
+private:
+    struct Slot {
+        atomic<const char *> name{nullptr};
+        atomic<uint64_t> start{0};
+        atomic<uint64_t> end{0};
+    };
+
+    atomic<size_t> head{0};     // Events published
+    atomic<size_t> claimed{0};  // Positions the writer has started on
+    unique_ptr<Slot[]> slots;
+};
+
+class Tracer {
+public:
+    static Tracer &instance() {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    // The calling thread's buffer, registered on first use. Buffers outlive
+    // their threads so spans from finished workers still get written.
+    TraceBuffer &local() {
+        thread_local TraceBuffer *buffer = nullptr;
+        if (!buffer) {
+            lock_guard<mutex> guard(lock);
+            buffers.push_back(make_shared<TraceBuffer>(static_cast<int>(buffers.size()) + 1));
+            buffer = buffers.back().get();
+        }
+        return *buffer;
+    }
+
+    void setOutput(const string &path) {
+        lock_guard<mutex> guard(lock);
+        outputPath = path;
+    }
+
+    bool write() {
+        lock_guard<mutex> guard(lock);
+        if (outputPath.empty())
+            return false;
+        ofstream out(outputPath);
+        double ticksPerMicrosecond = ticksPerNanosecond() * 1e3;
+        uint64_t origin = UINT64_MAX;
+        vector<vector<TraceEvent>> threads(buffers.size());
+        for (size_t i = 0; i < buffers.size(); ++i) {
+            buffers[i]->collect(threads[i]);
+            for (const TraceEvent &event : threads[i])
+                origin = min(origin, event.start);
+        }
+
+        out << "{\"traceEvents\":[";
+        bool first = true;
+        out << fixed << setprecision(3);
+        for (size_t i = 0; i < buffers.size(); ++i) {
+            for (const TraceEvent &event : threads[i]) {
+                out << (first ? "\n" : ",\n") << "{\"name\":\"" << event.name
+                    << "\",\"cat\":\"inventory\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffers[i]->threadId
+                    << ",\"ts\":" << (event.start - origin) / ticksPerMicrosecond
+                    << ",\"dur\":" << (event.end - event.start) / ticksPerMicrosecond << "}";
+                first = false;
+            }
+        }
+        out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+        return static_cast<bool>(out);
+    }
+
+private:
+    mutex lock;  // Guards registration and output, never held while recording
+    vector<shared_ptr<TraceBuffer>> buffers;
+    string outputPath;
+};
+
+class TraceSpan {
+public:
+    explicit TraceSpan(const char *name) : name(name), start(metricTicks()) {}
+    ~TraceSpan() { Tracer::instance().local().record(name, start, metricTicks()); }
+
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+    const char *name;
+    uint64_t start;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SPAN(name) TraceSpan TRACE_CONCAT(traceSpan, __LINE__)(name)
+
+inline void setTraceOutput(const string &path) { Tracer::instance().setOutput(path); }
+inline bool writeTrace() { return Tracer::instance().write(); }
+
+#else
+
+#define TRACE_SPAN(name) static_cast<void>(0)
+
+inline void setTraceOutput(const string &) {}
+inline bool writeTrace() { return false; }
+
+#endif  // INVENTORY_TRACING
+
+#endif  // TRACE_H